@@ -0,0 +1,473 @@
+#include "EffectVM.h"
+#include <Arduino.h>  // Enables use of Arduino specific functions and types
+#include <FastLED.h>
+#include "FS.h"
+#include "PrysmaLog.h"
+
+const TProgmemRGBPalette16* const PROGRAM_PALETTES[NUM_PROGRAM_PALETTES] = {
+    &RainbowColors_p, &HeatColors_p,   &OceanColors_p, &LavaColors_p,
+    &CloudColors_p,   &ForestColors_p, &PartyColors_p};
+
+//************************************************************************
+// Validation
+//************************************************************************
+// Look up how an opcode uses the stack and how much it costs to run, roughly
+// in ADDs. Returns false for unknown opcodes.
+bool getOpInfo(uint8_t op, byte* pops, byte* pushes, byte* immediateLength,
+               bool* isOutput, byte* weight) {
+  *pops = 0;
+  *pushes = 0;
+  *immediateLength = 0;
+  *isOutput = false;
+  *weight = 1;
+  switch (op) {
+    case OP_PUSH8:
+      *pushes = 1;
+      *immediateLength = 1;
+      return true;
+    case OP_PUSH16:
+      *pushes = 1;
+      *immediateLength = 2;
+      return true;
+    case OP_INDEX:
+    case OP_COUNT:
+    case OP_TIME:
+    case OP_SPEED:
+    case OP_HUE:
+      *pushes = 1;
+      return true;
+    case OP_RANDOM8:
+      *pushes = 1;
+      *weight = 2;
+      return true;
+    case OP_DUP:
+      *pops = 1;
+      *pushes = 2;
+      return true;
+    case OP_DROP:
+      *pops = 1;
+      return true;
+    case OP_SWAP:
+      *pops = 2;
+      *pushes = 2;
+      return true;
+    case OP_OVER:
+      *pops = 2;
+      *pushes = 3;
+      return true;
+    case OP_DIV:
+    case OP_MOD:
+      // No hardware divide on the ESP8266
+      *pops = 2;
+      *pushes = 1;
+      *weight = 4;
+      return true;
+    case OP_INOISE8:
+      *pops = 2;
+      *pushes = 1;
+      *weight = 32;
+      return true;
+    case OP_SCALE8:
+    case OP_QADD8:
+    case OP_QSUB8:
+      *pops = 2;
+      *pushes = 1;
+      *weight = 2;
+      return true;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_MIN:
+    case OP_MAX:
+    case OP_LT:
+    case OP_GT:
+    case OP_EQ:
+      *pops = 2;
+      *pushes = 1;
+      return true;
+    case OP_SIN8:
+    case OP_COS8:
+    case OP_TRIWAVE8:
+      *pops = 1;
+      *pushes = 1;
+      *weight = 2;
+      return true;
+    case OP_BEATSIN8:
+      // Reads millis() for every pixel
+      *pops = 3;
+      *pushes = 1;
+      *weight = 16;
+      return true;
+    case OP_JZ:
+      *pops = 1;
+      *immediateLength = 1;
+      return true;
+    case OP_JMP:
+      *immediateLength = 1;
+      return true;
+    case OP_RGB:
+      *pops = 3;
+      *isOutput = true;
+      return true;
+    case OP_HSV:
+      *pops = 3;
+      *isOutput = true;
+      *weight = 8;
+      return true;
+    case OP_PALETTE:
+      *pops = 2;
+      *immediateLength = 1;
+      *isOutput = true;
+      *weight = 12;
+      return true;
+  }
+  return false;
+}
+
+// Walk the code once, tracking the stack depth at every instruction. Since
+// jumps only go forward, every predecessor of an instruction has been visited
+// by the time we reach it.
+bool validateEffectCode(const uint8_t* code, uint16_t codeLength,
+                        uint16_t* cost) {
+  int8_t depth[MAX_PROGRAM_CODE_LENGTH];
+  memset(depth, -1, sizeof(depth));
+  depth[0] = 0;
+  *cost = 0;
+
+  uint16_t pc = 0;
+  while (pc < codeLength) {
+    uint8_t op = code[pc];
+    byte pops, pushes, immediateLength, weight;
+    bool isOutput;
+    if (!getOpInfo(op, &pops, &pushes, &immediateLength, &isOutput,
+                   &weight)) {
+      LOG_ERROR("Unknown opcode 0x%02X at %u", op, pc);
+      return false;
+    }
+    if (depth[pc] < 0) {
+      LOG_ERROR("Unreachable instruction at %u", pc);
+      return false;
+    }
+    if (pc + 1 + immediateLength > codeLength) {
+      LOG_ERROR("Truncated instruction at %u", pc);
+      return false;
+    }
+    if (depth[pc] < pops) {
+      LOG_ERROR("Stack underflow at %u", pc);
+      return false;
+    }
+    int newDepth = depth[pc] - pops + pushes;
+    if (newDepth > PROGRAM_STACK_SIZE) {
+      LOG_ERROR("Stack overflow at %u", pc);
+      return false;
+    }
+    if (op == OP_PALETTE && code[pc + 1] >= NUM_PROGRAM_PALETTES) {
+      LOG_ERROR("Unknown palette %u at %u", code[pc + 1], pc);
+      return false;
+    }
+    // Every instruction runs at most once per pixel, so the sum is the worst
+    // case
+    *cost += weight;
+
+    uint16_t next = pc + 1 + immediateLength;
+    // Record the stack depth at every place control can go next
+    uint16_t targets[2];
+    byte numTargets = 0;
+    if (op == OP_JZ || op == OP_JMP) {
+      targets[numTargets++] = next + code[pc + 1];
+    }
+    if (!isOutput && op != OP_JMP) {
+      targets[numTargets++] = next;
+    }
+    for (byte t = 0; t < numTargets; t++) {
+      uint16_t target = targets[t];
+      if (target >= codeLength) {
+        LOG_ERROR("Instruction at %u runs past the end", pc);
+        return false;
+      }
+      if (depth[target] < 0) {
+        depth[target] = newDepth;
+      } else if (depth[target] != newDepth) {
+        LOG_ERROR("Mismatched stack depth at %u", target);
+        return false;
+      }
+    }
+
+    // Jumps into the middle of an instruction are not allowed
+    for (uint16_t i = pc + 1; i < next; i++) {
+      if (depth[i] >= 0) {
+        LOG_ERROR("Jump into the middle of instruction %u", pc);
+        return false;
+      }
+    }
+    pc = next;
+  }
+
+  return true;
+}
+
+bool parseEffectProgram(const uint8_t* data, unsigned int length,
+                        EffectProgram* program) {
+  if (length < PROGRAM_HEADER_LENGTH || data[0] != PROGRAM_MAGIC_0 ||
+      data[1] != PROGRAM_MAGIC_1) {
+    LOG_ERROR("Effect program has an invalid header");
+    return false;
+  }
+  if (data[2] != PROGRAM_VERSION) {
+    LOG_ERROR("Unsupported effect program version %u", data[2]);
+    return false;
+  }
+
+  byte nameLength = data[3];
+  if (nameLength == 0 || nameLength > MAX_PROGRAM_NAME_LENGTH ||
+      length < PROGRAM_HEADER_LENGTH + nameLength + 2) {
+    LOG_ERROR("Effect program has an invalid name");
+    return false;
+  }
+  memcpy(program->name, data + PROGRAM_HEADER_LENGTH, nameLength);
+  program->name[nameLength] = '\0';
+
+  const uint8_t* codeLengthBytes = data + PROGRAM_HEADER_LENGTH + nameLength;
+  uint16_t codeLength = codeLengthBytes[0] | (codeLengthBytes[1] << 8);
+  if (codeLength > MAX_PROGRAM_CODE_LENGTH ||
+      length != PROGRAM_HEADER_LENGTH + nameLength + 2 + codeLength) {
+    LOG_ERROR("Effect program has an invalid code length");
+    return false;
+  }
+  program->codeLength = codeLength;
+  program->cost = 0;
+
+  // An empty program removes the effect with this name
+  if (codeLength == 0) {
+    return true;
+  }
+
+  memcpy(program->code, codeLengthBytes + 2, codeLength);
+  return validateEffectCode(program->code, codeLength, &program->cost);
+}
+
+//************************************************************************
+// Interpreter
+//************************************************************************
+// Run a validated program for a single pixel. Validation guarantees the stack
+// never under/overflows and every path ends in an output op, so there are no
+// runtime checks here.
+inline CRGB runPixel(const uint8_t* pc, int32_t index, int32_t numLeds,
+                     int32_t time, int32_t speed, int32_t hue) {
+  int32_t stack[PROGRAM_STACK_SIZE];
+  int32_t* sp = stack;  // Points at the next free slot
+  for (;;) {
+    switch (*pc++) {
+      case OP_PUSH8:
+        *sp++ = *pc++;
+        break;
+      case OP_PUSH16:
+        *sp++ = pc[0] | (pc[1] << 8);
+        pc += 2;
+        break;
+      case OP_INDEX:
+        *sp++ = index;
+        break;
+      case OP_COUNT:
+        *sp++ = numLeds;
+        break;
+      case OP_TIME:
+        *sp++ = time;
+        break;
+      case OP_SPEED:
+        *sp++ = speed;
+        break;
+      case OP_HUE:
+        *sp++ = hue;
+        break;
+      case OP_DUP:
+        sp[0] = sp[-1];
+        sp++;
+        break;
+      case OP_DROP:
+        sp--;
+        break;
+      case OP_SWAP: {
+        int32_t a = sp[-2];
+        sp[-2] = sp[-1];
+        sp[-1] = a;
+        break;
+      }
+      case OP_OVER:
+        sp[0] = sp[-2];
+        sp++;
+        break;
+      // Math that can overflow is done unsigned so it wraps around
+      case OP_ADD:
+        sp--;
+        sp[-1] = (uint32_t)sp[-1] + (uint32_t)sp[0];
+        break;
+      case OP_SUB:
+        sp--;
+        sp[-1] = (uint32_t)sp[-1] - (uint32_t)sp[0];
+        break;
+      case OP_MUL:
+        sp--;
+        sp[-1] = (uint32_t)sp[-1] * (uint32_t)sp[0];
+        break;
+      case OP_DIV:
+        // Dividing by -1 is a negate, which overflows for INT32_MIN
+        sp--;
+        if (sp[0] == -1) {
+          sp[-1] = 0U - (uint32_t)sp[-1];
+        } else {
+          sp[-1] = sp[0] ? sp[-1] / sp[0] : 0;
+        }
+        break;
+      case OP_MOD:
+        sp--;
+        sp[-1] = sp[0] && sp[0] != -1 ? sp[-1] % sp[0] : 0;
+        break;
+      case OP_AND:
+        sp--;
+        sp[-1] &= sp[0];
+        break;
+      case OP_OR:
+        sp--;
+        sp[-1] |= sp[0];
+        break;
+      case OP_XOR:
+        sp--;
+        sp[-1] ^= sp[0];
+        break;
+      case OP_SHL:
+        sp--;
+        sp[-1] = (uint32_t)sp[-1] << (sp[0] & 31);
+        break;
+      case OP_SHR:
+        sp--;
+        sp[-1] >>= (sp[0] & 31);
+        break;
+      case OP_MIN:
+        sp--;
+        sp[-1] = sp[0] < sp[-1] ? sp[0] : sp[-1];
+        break;
+      case OP_MAX:
+        sp--;
+        sp[-1] = sp[0] > sp[-1] ? sp[0] : sp[-1];
+        break;
+      case OP_LT:
+        sp--;
+        sp[-1] = sp[-1] < sp[0];
+        break;
+      case OP_GT:
+        sp--;
+        sp[-1] = sp[-1] > sp[0];
+        break;
+      case OP_EQ:
+        sp--;
+        sp[-1] = sp[-1] == sp[0];
+        break;
+      case OP_SIN8:
+        sp[-1] = sin8(sp[-1]);
+        break;
+      case OP_COS8:
+        sp[-1] = cos8(sp[-1]);
+        break;
+      case OP_TRIWAVE8:
+        sp[-1] = triwave8(sp[-1]);
+        break;
+      case OP_BEATSIN8:
+        sp -= 2;
+        sp[-1] = beatsin8(sp[-1], sp[0], sp[1]);
+        break;
+      case OP_INOISE8:
+        sp--;
+        sp[-1] = inoise8(sp[-1], sp[0]);
+        break;
+      case OP_SCALE8:
+        sp--;
+        sp[-1] = scale8(sp[-1], sp[0]);
+        break;
+      case OP_QADD8:
+        sp--;
+        sp[-1] = qadd8(sp[-1], sp[0]);
+        break;
+      case OP_QSUB8:
+        sp--;
+        sp[-1] = qsub8(sp[-1], sp[0]);
+        break;
+      case OP_RANDOM8:
+        *sp++ = random8();
+        break;
+      case OP_JZ: {
+        uint8_t offset = *pc++;
+        if (*--sp == 0) {
+          pc += offset;
+        }
+        break;
+      }
+      case OP_JMP: {
+        uint8_t offset = *pc++;
+        pc += offset;
+        break;
+      }
+      case OP_RGB:
+        return CRGB(sp[-3], sp[-2], sp[-1]);
+      case OP_HSV:
+        return CHSV(sp[-3], sp[-2], sp[-1]);
+      case OP_PALETTE:
+        return ColorFromPalette(*PROGRAM_PALETTES[*pc], sp[-2], sp[-1],
+                                LINEARBLEND);
+      default:
+        return CRGB::Black;
+    }
+  }
+}
+
+void runEffectProgram(const EffectProgram& program, CRGB* leds, int numLeds,
+                      uint32_t time, byte speed, byte hue) {
+  for (int i = 0; i < numLeds; i++) {
+    leds[i] = runPixel(program.code, i, numLeds, time, speed, hue);
+  }
+}
+
+//************************************************************************
+// Persistence
+//************************************************************************
+void getProgramPath(int slot, char* path, size_t size) {
+  snprintf(path, size, "/effect%i.bin", slot);
+}
+
+void saveEffectProgram(int slot, const uint8_t* data, unsigned int length) {
+  char path[16];
+  getProgramPath(slot, path, sizeof(path));
+  File file = SPIFFS.open(path, "w");
+  if (!file) {
+    LOG_ERROR("Failed to open %s for writing", path);
+    return;
+  }
+  file.write(data, length);
+  file.close();
+}
+
+void deleteEffectProgram(int slot) {
+  char path[16];
+  getProgramPath(slot, path, sizeof(path));
+  SPIFFS.remove(path);
+}
+
+unsigned int readEffectProgram(int slot, uint8_t* buffer, unsigned int size) {
+  char path[16];
+  getProgramPath(slot, path, sizeof(path));
+  if (!SPIFFS.exists(path)) {
+    return 0;
+  }
+  File file = SPIFFS.open(path, "r");
+  if (!file) {
+    return 0;
+  }
+  unsigned int length = file.read(buffer, size);
+  file.close();
+  return length;
+}
@@ -0,0 +1,107 @@
+/*
+  EffectVM.h - Library for validating and running user-defined effect programs
+*/
+#ifndef EffectVM_h
+#define EffectVM_h
+
+#include <Arduino.h>
+#define FASTLED_INTERNAL  // Disable pragma messages
+#include <FastLED.h>
+
+// Maximum number of uploaded programs the light can hold at once
+#define MAX_EFFECT_PROGRAMS 4
+#define MAX_PROGRAM_NAME_LENGTH 16
+#define MAX_PROGRAM_CODE_LENGTH 128
+#define PROGRAM_STACK_SIZE 16
+// Upper bound on the cost of a frame (cost per pixel * numLeds). Ops are
+// weighted by how long they take, roughly in ADDs, so this keeps a program's
+// render time inside the 60 FPS frame budget alongside FastLED.show(). Tune
+// with PRINT_VM_TIMING in Light.h.
+#define PROGRAM_FRAME_BUDGET 16000
+// Program header: magic "PX", version, name length
+#define PROGRAM_MAGIC_0 'P'
+#define PROGRAM_MAGIC_1 'X'
+#define PROGRAM_VERSION 1
+#define PROGRAM_HEADER_LENGTH 4
+#define MAX_PROGRAM_LENGTH                                \
+  (PROGRAM_HEADER_LENGTH + MAX_PROGRAM_NAME_LENGTH + 2 + \
+   MAX_PROGRAM_CODE_LENGTH)
+
+/*
+  Opcodes. Every program runs once per pixel on a stack of 32 bit integers and
+  must end every path with an output op (RGB, HSV or PALETTE). Jumps can only
+  go forward, so a program can never execute more instructions per pixel than
+  it contains.
+*/
+enum EffectOp : uint8_t {
+  // Push values (imm = immediate bytes following the opcode)
+  OP_PUSH8 = 0x01,   // imm8                   -> value
+  OP_PUSH16 = 0x02,  // imm16 (little endian)  -> value
+  OP_INDEX = 0x03,   //                        -> pixel index
+  OP_COUNT = 0x04,   //                        -> number of leds
+  OP_TIME = 0x05,    //                        -> ms since the effect started
+  OP_SPEED = 0x06,   //                        -> speed (1-7)
+  OP_HUE = 0x07,     //                        -> cycling hue (0-255)
+  // Stack manipulation
+  OP_DUP = 0x08,   // a       -> a a
+  OP_DROP = 0x09,  // a       ->
+  OP_SWAP = 0x0A,  // a b     -> b a
+  OP_OVER = 0x0B,  // a b     -> a b a
+  // Arithmetic and logic (a b -> a OP b)
+  OP_ADD = 0x10,
+  OP_SUB = 0x11,
+  OP_MUL = 0x12,
+  OP_DIV = 0x13,  // Division by zero gives 0
+  OP_MOD = 0x14,  // Modulo by zero gives 0
+  OP_AND = 0x15,
+  OP_OR = 0x16,
+  OP_XOR = 0x17,
+  OP_SHL = 0x18,
+  OP_SHR = 0x19,
+  OP_MIN = 0x1A,
+  OP_MAX = 0x1B,
+  OP_LT = 0x1C,
+  OP_GT = 0x1D,
+  OP_EQ = 0x1E,
+  // FastLED math helpers
+  OP_SIN8 = 0x20,      // a          -> sin8(a)
+  OP_COS8 = 0x21,      // a          -> cos8(a)
+  OP_TRIWAVE8 = 0x22,  // a          -> triwave8(a)
+  OP_BEATSIN8 = 0x23,  // bpm lo hi  -> beatsin8(bpm, lo, hi)
+  OP_INOISE8 = 0x24,   // x y        -> inoise8(x, y)
+  OP_SCALE8 = 0x25,    // a b        -> scale8(a, b)
+  OP_QADD8 = 0x26,     // a b        -> qadd8(a, b)
+  OP_QSUB8 = 0x27,     // a b        -> qsub8(a, b)
+  OP_RANDOM8 = 0x28,   //            -> random8()
+  // Control flow (offsets are relative to the next instruction)
+  OP_JZ = 0x30,   // imm8: a ->, jump forward if a == 0
+  OP_JMP = 0x31,  // imm8: jump forward
+  // Output (sets the pixel and ends the program for this pixel)
+  OP_RGB = 0x40,      // r g b
+  OP_HSV = 0x41,      // h s v
+  OP_PALETTE = 0x42,  // imm8 palette: index brightness
+};
+
+// Palettes available to OP_PALETTE, in immediate order
+#define NUM_PROGRAM_PALETTES 7
+
+typedef struct {
+  bool used;
+  char name[MAX_PROGRAM_NAME_LENGTH + 1];
+  uint8_t code[MAX_PROGRAM_CODE_LENGTH];
+  uint16_t codeLength;
+  uint16_t cost;  // Worst case weighted ops executed per pixel
+} EffectProgram;
+
+bool parseEffectProgram(const uint8_t* data, unsigned int length,
+                        EffectProgram* program);
+
+void runEffectProgram(const EffectProgram& program, CRGB* leds, int numLeds,
+                      uint32_t time, byte speed, byte hue);
+
+// SPIFFS persistence so uploaded programs survive a reboot
+void saveEffectProgram(int slot, const uint8_t* data, unsigned int length);
+void deleteEffectProgram(int slot);
+unsigned int readEffectProgram(int slot, uint8_t* buffer, unsigned int size);
+
+#endif
@@ -0,0 +1,293 @@
+#include "LedDriver.h"
+#include "LedOutputs.h"
+#include <Arduino.h>  // Enables use of Arduino specific functions and types
+#include <FastLED.h>
+#include <NeoPixelBus.h>
+#include "PrysmaLog.h"
+
+// The hardware backed strips can only exist once, so they live here instead of
+// in the driver classes
+NeoPixelBus<NeoGrbFeature, NeoEsp8266Dma800KbpsMethod>* dmaStrip = NULL;
+NeoPixelBus<NeoGrbFeature, NeoEsp8266AsyncUart1800KbpsMethod>* uartStrip =
+    NULL;
+
+// The output stage has already put the channels in strip order, so frames go
+// into the NeoPixelBus buffer as raw bytes without going through its color
+// feature
+void copyToPixels(uint8_t* pixels, const CRGB* leds, int numLeds) {
+  memcpy(pixels, leds, numLeds * sizeof(CRGB));
+}
+
+//************************************************************************
+// FastLED
+//************************************************************************
+bool FastLEDDriver::begin(CRGB* leds, int numLeds, const char* stripType,
+                          const char* colorOrder, int dataPin, int clockPin) {
+  // FastLED needs the chipset, pins and color order as template parameters,
+  // so look up the controller that was compiled for this config
+  LOG_INFO("LED output table has %u entries, sketch uses %u bytes (%u free)",
+           getNumLedOutputs(), ESP.getSketchSize(), ESP.getFreeSketchSpace());
+  const LedOutput* output =
+      findLedOutput(stripType, colorOrder, dataPin, clockPin);
+  if (output == NULL) {
+    LOG_WARNING(
+        "No LED output for %s + %s on pins %i/%i, using default WS2812B on "
+        "pin 5",
+        stripType, colorOrder, dataPin, clockPin);
+    output = findLedOutput("WS2812B", "RGB", 5, -1);
+    if (output == NULL) {
+      LOG_ERROR("The default LED output isn't in the table");
+      return false;
+    }
+  } else {
+    LOG_INFO("Using %s on pins %i/%i", stripType, dataPin, clockPin);
+  }
+  output->addLeds(leds, numLeds);
+  // Brightness is applied by the output stage
+  FastLED.setBrightness(255);
+  return true;
+}
+
+bool FastLEDDriver::canShow() { return true; }
+
+void FastLEDDriver::show(const CRGB* leds, int numLeds) {
+  // FastLED already has a pointer to the leds from FastLED.addLeds
+  FastLED.show();
+}
+
+//************************************************************************
+// Parallel
+//************************************************************************
+bool ParallelDriver::setOutputs(const int* lengths, int numOutputs) {
+  if (numOutputs > MAX_LED_OUTPUTS) {
+    LOG_ERROR("Only %i parallel outputs are supported", MAX_LED_OUTPUTS);
+    return false;
+  }
+  for (int i = 0; i < numOutputs; i++) {
+    if (lengths[i] < 1) {
+      LOG_ERROR("Output %i has %i leds", i, lengths[i]);
+      return false;
+    }
+  }
+  memcpy(this->lengths, lengths, numOutputs * sizeof(int));
+  this->numOutputs = numOutputs;
+  return true;
+}
+
+bool ParallelDriver::begin(CRGB* leds, int numLeds, const char* stripType,
+                           const char* colorOrder, int dataPin,
+                           int clockPin) {
+  if (clockPin > 0) {
+    LOG_ERROR("The parallel driver only supports 3 pin strips");
+    return false;
+  }
+  if (this->numOutputs < 2) {
+    LOG_ERROR("The parallel driver needs 2-4 outputs");
+    return false;
+  }
+  if (numLeds > MAX_LEDS) {
+    LOG_ERROR("The parallel driver supports up to %i leds", MAX_LEDS);
+    return false;
+  }
+  // The lanes are always driven with WS2811 timing
+  if (strcmp(stripType, "WS2812B") != 0 && strcmp(stripType, "WS2811") != 0) {
+    LOG_WARNING("The parallel driver uses WS2811 timing, %s may not work",
+                stripType);
+  }
+  int totalLeds = 0;
+  for (int i = 0; i < this->numOutputs; i++) {
+    totalLeds += this->lengths[i];
+    this->laneLength = max(this->laneLength, this->lengths[i]);
+  }
+  if (totalLeds != numLeds) {
+    LOG_ERROR("The outputs add up to %i leds instead of %i", totalLeds,
+              numLeds);
+    return false;
+  }
+
+  // FastLED sends lane after lane from one buffer, so when the outputs are
+  // the same length that's just leds. Otherwise every frame gets copied into
+  // padded lanes
+  CRGB* laneLeds = leds;
+  if (this->laneLength * this->numOutputs != numLeds) {
+    this->lanes = new CRGB[this->numOutputs * this->laneLength];
+    fill_solid(this->lanes, this->numOutputs * this->laneLength,
+               CRGB::Black);
+    laneLeds = this->lanes;
+  }
+  // The number of lanes is a template parameter
+  switch (this->numOutputs) {
+    case 2: {
+      FastLED.addLeds<WS2811_PORTA, 2, RGB>(laneLeds, this->laneLength);
+      break;
+    }
+    case 3: {
+      FastLED.addLeds<WS2811_PORTA, 3, RGB>(laneLeds, this->laneLength);
+      break;
+    }
+    default: {
+      FastLED.addLeds<WS2811_PORTA, 4, RGB>(laneLeds, this->laneLength);
+      break;
+    }
+  }
+  // Brightness is applied by the output stage
+  FastLED.setBrightness(255);
+  LOG_INFO("Using %i parallel outputs on GPIO12-%i, %i us per frame",
+           this->numOutputs, 11 + this->numOutputs,
+           this->laneLength * LED_SEND_TIME);
+  return true;
+}
+
+bool ParallelDriver::canShow() { return true; }
+
+void ParallelDriver::show(const CRGB* leds, int numLeds) {
+  if (this->lanes != NULL) {
+    const CRGB* segment = leds;
+    for (int i = 0; i < this->numOutputs; i++) {
+      memcpy(&this->lanes[i * this->laneLength], segment,
+             this->lengths[i] * sizeof(CRGB));
+      segment += this->lengths[i];
+    }
+  }
+  FastLED.show();
+}
+
+//************************************************************************
+// I2S DMA
+//************************************************************************
+bool I2SDmaDriver::begin(CRGB* leds, int numLeds, const char* stripType,
+                         const char* colorOrder, int dataPin, int clockPin) {
+  if (clockPin > 0) {
+    LOG_ERROR("The I2S driver only supports 3 pin strips");
+    return false;
+  }
+  LOG_INFO("Using I2S DMA on GPIO3 (RX)");
+  dmaStrip =
+      new NeoPixelBus<NeoGrbFeature, NeoEsp8266Dma800KbpsMethod>(numLeds);
+  dmaStrip->Begin();
+  return true;
+}
+
+bool I2SDmaDriver::canShow() { return dmaStrip->CanShow(); }
+
+void I2SDmaDriver::show(const CRGB* leds, int numLeds) {
+  copyToPixels(dmaStrip->Pixels(), leds, numLeds);
+  dmaStrip->Dirty();
+  // Encodes the frame into the DMA buffer and returns while it is sent
+  dmaStrip->Show(false);
+}
+
+//************************************************************************
+// UART
+//************************************************************************
+bool UartDriver::begin(CRGB* leds, int numLeds, const char* stripType,
+                       const char* colorOrder, int dataPin, int clockPin) {
+  if (clockPin > 0) {
+    LOG_ERROR("The UART driver only supports 3 pin strips");
+    return false;
+  }
+  LOG_INFO("Using async UART1 on GPIO2 (TX1)");
+  uartStrip =
+      new NeoPixelBus<NeoGrbFeature, NeoEsp8266AsyncUart1800KbpsMethod>(
+          numLeds);
+  uartStrip->Begin();
+  return true;
+}
+
+bool UartDriver::canShow() { return uartStrip->CanShow(); }
+
+void UartDriver::show(const CRGB* leds, int numLeds) {
+  copyToPixels(uartStrip->Pixels(), leds, numLeds);
+  uartStrip->Dirty();
+  // Swaps buffers with the UART interrupt and returns while it is sent
+  uartStrip->Show(false);
+}
+
+//************************************************************************
+// Mock
+//************************************************************************
+bool MockDriver::begin(CRGB* leds, int numLeds, const char* stripType,
+                       const char* colorOrder, int dataPin, int clockPin) {
+  if (this->showTime == 0) {
+    this->showTime = numLeds * LED_SEND_TIME;
+  }
+  LOG_INFO("Using mock LED driver, %lu us per frame", this->showTime);
+  return true;
+}
+
+bool MockDriver::canShow() {
+  if (this->showCount > 0 &&
+      micros() - this->lastShowTime < this->showTime) {
+    this->skippedCount++;
+    return false;
+  }
+  return true;
+}
+
+void MockDriver::show(const CRGB* leds, int numLeds) {
+  unsigned long now = micros();
+  if (this->showCount > 0) {
+    unsigned long interval = now - this->lastShowTime;
+    if (this->minInterval == 0 || interval < this->minInterval) {
+      this->minInterval = interval;
+    }
+    if (interval > this->maxInterval) {
+      this->maxInterval = interval;
+    }
+  }
+  this->lastShowTime = now;
+  this->showCount++;
+#if PRINT_MOCK_TIMING
+  printTiming(now);
+#endif
+}
+
+#if PRINT_MOCK_TIMING
+void MockDriver::printTiming(unsigned long now) {
+  if (now - this->lastPrintTime < MOCK_TIMING_INTERVAL * 1000UL) {
+    return;
+  }
+  LOG_DEBUG("Mock: %lu shows, %lu skipped, %lu-%lu us apart",
+            this->showCount - this->printShowCount,
+            this->skippedCount - this->printSkippedCount, this->minInterval,
+            this->maxInterval);
+  this->lastPrintTime = now;
+  this->printShowCount = this->showCount;
+  this->printSkippedCount = this->skippedCount;
+  // The next range starts from here
+  this->minInterval = 0;
+  this->maxInterval = 0;
+}
+#endif
+
+void MockDriver::setShowTime(unsigned long showTime) {
+  this->showTime = showTime;
+}
+
+unsigned long MockDriver::getShowCount() { return this->showCount; }
+
+unsigned long MockDriver::getSkippedCount() { return this->skippedCount; }
+
+unsigned long MockDriver::getLastShowTime() { return this->lastShowTime; }
+
+unsigned long MockDriver::getMinInterval() { return this->minInterval; }
+
+unsigned long MockDriver::getMaxInterval() { return this->maxInterval; }
+
+//************************************************************************
+// Factory
+//************************************************************************
+LedDriver* createLedDriver(const char* type) {
+  if (strcmp(type, "i2s") == 0) {
+    return new I2SDmaDriver();
+  } else if (strcmp(type, "uart") == 0) {
+    return new UartDriver();
+  } else if (strcmp(type, "mock") == 0) {
+    return new MockDriver();
+  } else if (strcmp(type, "parallel") == 0) {
+    return new ParallelDriver();
+  } else if (strcmp(type, DEFAULT_LED_DRIVER) != 0) {
+    LOG_WARNING("Unknown LED driver %s, using %s", type, DEFAULT_LED_DRIVER);
+  }
+  return new FastLEDDriver();
+}
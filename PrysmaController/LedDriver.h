@@ -0,0 +1,119 @@
+/*
+  LedDriver.h - Library for pushing frames from Light out to the LED strip
+*/
+#ifndef LedDriver_h
+#define LedDriver_h
+
+#include <Arduino.h>
+#define FASTLED_INTERNAL  // Disable pragma messages
+#include <FastLED.h>
+
+#define DEFAULT_LED_DRIVER "fastled"
+#define MAX_LED_OUTPUTS 4  // GPIO12-15 are the ESP8266's parallel outputs
+#define LED_SEND_TIME 30   // In us per WS2812B led at 800kHz
+#define MAX_LEDS 512       // Size of the frame buffers
+// Toggles mock driver timing (1 = log shows, skipped frames and the intervals
+// between shows at the debug level every MOCK_TIMING_INTERVAL ms)
+#define PRINT_MOCK_TIMING 0
+#define MOCK_TIMING_INTERVAL 1000
+
+class LedDriver {
+ public:
+  virtual ~LedDriver() {}
+  virtual bool begin(CRGB* leds, int numLeds, const char* stripType,
+                     const char* colorOrder, int dataPin, int clockPin) = 0;
+  // Split the leds across several outputs, in order, before begin. Drivers
+  // with a single output return false
+  virtual bool setOutputs(const int* lengths, int numOutputs) {
+    return false;
+  }
+  // Returns false while the previous frame is still being sent
+  virtual bool canShow() = 0;
+  // Send a frame that is already color corrected and in strip order.
+  // Asynchronous drivers copy the frame and return straight away, so leds can
+  // be drawn into again while it is being sent
+  virtual void show(const CRGB* leds, int numLeds) = 0;
+};
+
+// FastLED bit-bangs the strip with interrupts disabled and only returns once
+// the whole frame has been sent
+class FastLEDDriver : public LedDriver {
+ public:
+  bool begin(CRGB* leds, int numLeds, const char* stripType,
+             const char* colorOrder, int dataPin, int clockPin);
+  bool canShow();
+  void show(const CRGB* leds, int numLeds);
+};
+
+// Sends 2-4 strips at once on GPIO12-15 (NodeMCU D6, D7, D5, D8) with
+// FastLED's parallel output, so a frame takes as long as the longest strip
+// instead of all of them together
+class ParallelDriver : public LedDriver {
+ public:
+  bool setOutputs(const int* lengths, int numOutputs);
+  bool begin(CRGB* leds, int numLeds, const char* stripType,
+             const char* colorOrder, int dataPin, int clockPin);
+  bool canShow();
+  void show(const CRGB* leds, int numLeds);
+
+ private:
+  int lengths[MAX_LED_OUTPUTS];
+  int numOutputs = 0;
+  int laneLength = 0;  // Longest output. Shorter ones are padded to it
+  CRGB* lanes = NULL;  // NULL when every output is the same length
+};
+
+// Sends the frame with the I2S peripheral over DMA. The ESP8266 can only do
+// this on GPIO3 (RX)
+class I2SDmaDriver : public LedDriver {
+ public:
+  bool begin(CRGB* leds, int numLeds, const char* stripType,
+             const char* colorOrder, int dataPin, int clockPin);
+  bool canShow();
+  void show(const CRGB* leds, int numLeds);
+};
+
+// Sends the frame from the UART1 FIFO using interrupts. The ESP8266 can only
+// do this on GPIO2 (TX1)
+class UartDriver : public LedDriver {
+ public:
+  bool begin(CRGB* leds, int numLeds, const char* stripType,
+             const char* colorOrder, int dataPin, int clockPin);
+  bool canShow();
+  void show(const CRGB* leds, int numLeds);
+};
+
+// Doesn't drive any hardware. Records when frames would have been sent so the
+// render loop can be timed without a strip attached. Acts like a WS2812B strip
+// that takes LED_SEND_TIME per led unless setShowTime is called first
+class MockDriver : public LedDriver {
+ public:
+  bool begin(CRGB* leds, int numLeds, const char* stripType,
+             const char* colorOrder, int dataPin, int clockPin);
+  bool canShow();
+  void show(const CRGB* leds, int numLeds);
+  void setShowTime(unsigned long showTime);
+  unsigned long getShowCount();
+  unsigned long getSkippedCount();
+  unsigned long getLastShowTime();
+  unsigned long getMinInterval();
+  unsigned long getMaxInterval();
+
+ private:
+  unsigned long showTime = 0;  // Simulated time to send a frame in us
+  unsigned long showCount = 0;
+  unsigned long skippedCount = 0;
+  unsigned long lastShowTime = 0;
+  unsigned long minInterval = 0;
+  unsigned long maxInterval = 0;
+#if PRINT_MOCK_TIMING
+  unsigned long lastPrintTime = 0;
+  unsigned long printShowCount = 0;
+  unsigned long printSkippedCount = 0;
+  void printTiming(unsigned long now);
+#endif
+};
+
+LedDriver* createLedDriver(const char* type);
+
+#endif
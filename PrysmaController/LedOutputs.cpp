@@ -0,0 +1,168 @@
+#include "LedOutputs.h"
+#include <Arduino.h>  // Enables use of Arduino specific functions and types
+#include <FastLED.h>
+
+// Report what went into the table in the build output
+#define LED_OUTPUTS_STRINGIFY(...) #__VA_ARGS__
+#define LED_OUTPUTS_STRING(...) LED_OUTPUTS_STRINGIFY(__VA_ARGS__)
+#pragma message("LED outputs: data pins {" LED_OUTPUTS_STRING(LED_DATA_PINS) "}")
+#pragma message("LED outputs: clocked pins {" LED_OUTPUTS_STRING( \
+    LED_CLOCKED_PINS) "}")
+#pragma message("LED outputs: color orders {" LED_OUTPUTS_STRING( \
+    LED_COLOR_ORDERS) "}")
+
+template <uint8_t... PINS>
+struct LedPinList {};
+
+template <uint8_t DATA_PIN, uint8_t CLOCK_PIN>
+struct LedPinPair {
+  static const uint8_t data = DATA_PIN;
+  static const uint8_t clock = CLOCK_PIN;
+};
+
+//************************************************************************
+// 3 pin strips
+//************************************************************************
+template <template <uint8_t, EOrder> class CHIPSET, EOrder ORDER,
+          uint8_t DATA_PIN>
+CLEDController& addClocklessLeds(CRGB* leds, int numLeds) {
+  return FastLED.addLeds<CHIPSET, DATA_PIN, ORDER>(leds, numLeds);
+}
+
+// One row of the table: every data pin for a chipset and color order
+template <template <uint8_t, EOrder> class CHIPSET, EOrder ORDER, class PINS>
+struct ClocklessRow;
+
+template <template <uint8_t, EOrder> class CHIPSET, EOrder ORDER,
+          uint8_t... DATA_PINS>
+struct ClocklessRow<CHIPSET, ORDER, LedPinList<DATA_PINS...> > {
+  static const LedOutput outputs[sizeof...(DATA_PINS)];
+};
+
+template <template <uint8_t, EOrder> class CHIPSET, EOrder ORDER,
+          uint8_t... DATA_PINS>
+const LedOutput ClocklessRow<CHIPSET, ORDER, LedPinList<DATA_PINS...> >::
+    outputs[sizeof...(DATA_PINS)] = {
+        {ORDER, DATA_PINS, -1,
+         &addClocklessLeds<CHIPSET, ORDER, DATA_PINS> }...};
+
+template <template <uint8_t, EOrder> class CHIPSET, EOrder... ORDERS>
+struct ClocklessChipset {
+  static const LedOutput* const rows[sizeof...(ORDERS)];
+};
+
+template <template <uint8_t, EOrder> class CHIPSET, EOrder... ORDERS>
+const LedOutput* const ClocklessChipset<CHIPSET, ORDERS...>::rows[sizeof...(
+    ORDERS)] = {
+    ClocklessRow<CHIPSET, ORDERS, LedPinList<LED_DATA_PINS> >::outputs...};
+
+//************************************************************************
+// 4 pin strips
+//************************************************************************
+template <ESPIChipsets CHIPSET, EOrder ORDER, uint8_t DATA_PIN,
+          uint8_t CLOCK_PIN>
+CLEDController& addClockedLeds(CRGB* leds, int numLeds) {
+  return FastLED.addLeds<CHIPSET, DATA_PIN, CLOCK_PIN, ORDER>(leds, numLeds);
+}
+
+// One row of the table: every pin pair for a chipset and color order
+template <ESPIChipsets CHIPSET, EOrder ORDER, class... PIN_PAIRS>
+struct ClockedRow {
+  static const LedOutput outputs[sizeof...(PIN_PAIRS)];
+};
+
+template <ESPIChipsets CHIPSET, EOrder ORDER, class... PIN_PAIRS>
+const LedOutput ClockedRow<CHIPSET, ORDER, PIN_PAIRS...>::outputs[sizeof...(
+    PIN_PAIRS)] = {
+    {ORDER, PIN_PAIRS::data, PIN_PAIRS::clock,
+     &addClockedLeds<CHIPSET, ORDER, PIN_PAIRS::data, PIN_PAIRS::clock> }...};
+
+template <ESPIChipsets CHIPSET, EOrder... ORDERS>
+struct ClockedChipset {
+  static const LedOutput* const rows[sizeof...(ORDERS)];
+};
+
+template <ESPIChipsets CHIPSET, EOrder... ORDERS>
+const LedOutput* const ClockedChipset<CHIPSET, ORDERS...>::rows[sizeof...(
+    ORDERS)] = {ClockedRow<CHIPSET, ORDERS, LED_CLOCKED_PINS>::outputs...};
+
+//************************************************************************
+// Table
+//************************************************************************
+template <class... T>
+struct LedCount {
+  static const byte value = sizeof...(T);
+};
+
+template <uint8_t... PINS>
+struct LedPinCount {
+  static const byte value = sizeof...(PINS);
+};
+
+template <EOrder... ORDERS>
+struct LedOrderCount {
+  static const byte value = sizeof...(ORDERS);
+};
+
+#define NUM_LED_DATA_PINS LedPinCount<LED_DATA_PINS>::value
+#define NUM_LED_CLOCKED_PINS LedCount<LED_CLOCKED_PINS>::value
+#define NUM_LED_COLOR_ORDERS LedOrderCount<LED_COLOR_ORDERS>::value
+
+// ADD_CHIPSET: Add the chipset to this table
+#define CLOCKLESS_CHIPSET(CHIPSET)                                 \
+  {#CHIPSET, ClocklessChipset<CHIPSET, LED_COLOR_ORDERS>::rows,    \
+   NUM_LED_COLOR_ORDERS, NUM_LED_DATA_PINS}
+#define CLOCKED_CHIPSET(CHIPSET)                                   \
+  {#CHIPSET, ClockedChipset<CHIPSET, LED_COLOR_ORDERS>::rows,      \
+   NUM_LED_COLOR_ORDERS, NUM_LED_CLOCKED_PINS}
+
+const LedChipset LED_CHIPSETS[] = {
+    CLOCKLESS_CHIPSET(WS2812B), CLOCKLESS_CHIPSET(WS2811),
+    CLOCKLESS_CHIPSET(SK6812),  CLOCKED_CHIPSET(APA102),
+    CLOCKED_CHIPSET(SK9822),    CLOCKED_CHIPSET(WS2801)};
+
+const LedOutput* findLedOutput(const char* stripType, const char* colorOrder,
+                               int dataPin, int clockPin) {
+  for (const LedChipset& chipset : LED_CHIPSETS) {
+    if (strcmp(chipset.stripType, stripType) != 0) {
+      continue;
+    }
+    for (byte row = 0; row < chipset.numRows; row++) {
+      for (byte i = 0; i < chipset.rowLength; i++) {
+        const LedOutput* output = &chipset.rows[row][i];
+        if (output->dataPin == dataPin &&
+            output->clockPin == max(clockPin, -1) &&
+            strcmp(getColorOrderName(output->colorOrder), colorOrder) == 0) {
+          return output;
+        }
+      }
+    }
+  }
+  return NULL;
+}
+
+const char* getColorOrderName(EOrder colorOrder) {
+  switch (colorOrder) {
+    case RGB:
+      return "RGB";
+    case RBG:
+      return "RBG";
+    case GRB:
+      return "GRB";
+    case GBR:
+      return "GBR";
+    case BRG:
+      return "BRG";
+    case BGR:
+      return "BGR";
+  }
+  return "";
+}
+
+unsigned int getNumLedOutputs() {
+  unsigned int numOutputs = 0;
+  for (const LedChipset& chipset : LED_CHIPSETS) {
+    numOutputs += chipset.numRows * chipset.rowLength;
+  }
+  return numOutputs;
+}
@@ -0,0 +1,56 @@
+/*
+  LedOutputs.h - Library for picking a FastLED controller from the config at
+  runtime
+*/
+#ifndef LedOutputs_h
+#define LedOutputs_h
+
+#include <Arduino.h>
+#define FASTLED_INTERNAL  // Disable pragma messages
+#include <FastLED.h>
+
+/*
+  FastLED needs the chipset, pins and color order as template parameters, so
+  every combination the config can ask for is instantiated here at compile
+  time. Every entry costs flash, so trim these lists with build flags for
+  firmware that only ever drives one kind of strip.
+*/
+// FastLED pin numbers for 3 pin strips (D1-D8 on a NodeMCU). D0 has no fast
+// GPIO and D9/D10 are used by Serial.
+#ifndef LED_DATA_PINS
+#define LED_DATA_PINS 1, 2, 3, 4, 5, 6, 7, 8
+#endif
+// Data and clock pins for 4 pin strips. D7/D5 is the hardware SPI pair.
+#ifndef LED_CLOCKED_PINS
+#define LED_CLOCKED_PINS \
+  LedPinPair<7, 5>, LedPinPair<5, 6>, LedPinPair<1, 2>
+#endif
+// Light's output stage reorders the channels itself and always asks for RGB,
+// so the other orders are only needed if something else drives FastLED
+#ifndef LED_COLOR_ORDERS
+#define LED_COLOR_ORDERS RGB
+#endif
+
+typedef CLEDController& (*AddLedsFunction)(CRGB* leds, int numLeds);
+
+typedef struct {
+  EOrder colorOrder;
+  int8_t dataPin;
+  int8_t clockPin;  // -1 for 3 pin strips
+  AddLedsFunction addLeds;
+} LedOutput;
+
+// Every output for one chipset, with one row per color order
+typedef struct {
+  const char* stripType;
+  const LedOutput* const* rows;
+  byte numRows;
+  byte rowLength;
+} LedChipset;
+
+const LedOutput* findLedOutput(const char* stripType, const char* colorOrder,
+                               int dataPin, int clockPin);
+const char* getColorOrderName(EOrder colorOrder);
+unsigned int getNumLedOutputs();
+
+#endif
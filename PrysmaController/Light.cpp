@@ -1,7 +1,9 @@
 #include "Light.h"
 #include <Arduino.h>  // Enables use of Arduino specific functions and types
+#include <ESP8266WiFi.h>
 #include <FastLED.h>
 #include <WiFiUdp.h>
+#include "PrysmaLog.h"
 WiFiUDP port;
 
 //************************************************************************
@@ -10,35 +12,52 @@ WiFiUDP port;
 Light::Light() {}
 
 void Light::init(int numLeds, char* stripType, char* colorOrder, int dataPin,
-                 int clockPin, byte maxBrightness) {
+                 int clockPin, byte maxBrightness, char* driverType,
+                 int* outputLengths, int numOutputs) {
+  // Every frame buffer holds MAX_LEDS
+  if (numLeds < 1 || numLeds > MAX_LEDS) {
+    LOG_ERROR("numLeds must be 1-%i, got %i", MAX_LEDS, numLeds);
+    numLeds = constrain(numLeds, 1, MAX_LEDS);
+  }
   this->numLeds = numLeds;
   this->maxBrightness = maxBrightness;
+  this->sliceLength = numLeds;
 
   // Start listening for UDP Packets
   port.begin(localPort);
 
+  // The output stage puts the channels in strip order, so the drivers always
+  // get RGB
+  if (!this->output.setColorOrder(colorOrder)) {
+    this->output.setColorOrder("GRB");
+  }
+
   // Initialize the leds
-  // Currently I need to specify all these combinations manually since FastLED
-  // requires all variables in the template to be constants
-  if (clockPin > 0) {
-    Serial.println("[INFO]: Using 4 pin default APA102 + RGB");
-    FastLED.addLeds<APA102, 5, 6, RGB>(this->leds, this->numLeds);
-  } else if (strcmp(stripType, "WS2811") == 0) {
-    Serial.println("[INFO]: Using WS2811 + GRB");
-    FastLED.addLeds<WS2811, 5, GRB>(this->leds, this->numLeds);
-  } else {
-    Serial.println("[INFO]: Using default WS2812B + GRB");
-    FastLED.addLeds<WS2812B, 5, GRB>(this->leds, this->numLeds);
+  this->driver = createLedDriver(driverType);
+  // Effects still draw into one buffer of numLeds, the driver splits it up
+  if (numOutputs > 0 &&
+      !this->driver->setOutputs(outputLengths, numOutputs)) {
+    LOG_WARNING("The %s driver doesn't support outputs, ignoring them",
+                driverType);
+  }
+  if (!this->driver->begin(this->leds, this->numLeds, stripType, "RGB",
+                           dataPin, clockPin)) {
+    LOG_WARNING("Could not start the %s driver, using %s", driverType,
+                DEFAULT_LED_DRIVER);
+    delete this->driver;
+    this->driver = createLedDriver(DEFAULT_LED_DRIVER);
+    this->driver->begin(this->leds, this->numLeds, stripType, "RGB", dataPin,
+                        clockPin);
   }
 
   // Set the initial brightness
-  FastLED.setBrightness(maxBrightness);
+  this->outputBrightness = maxBrightness;
   // Clear the LEDs
   fill_solid(this->leds, this->numLeds, CRGB::Black);
-  FastLED.show();
+  this->driver->show(this->leds, this->numLeds);
 
-  // Initialize the color to the current state
-  fill_solid(this->leds, this->numLeds, this->state.color);
+  // Restore any effect programs uploaded before the last reboot
+  loadPrograms();
 }
 
 void Light::loop() {
@@ -48,6 +67,9 @@ void Light::loop() {
   // Handle Color transitions
   handleColorTransition();
 
+  // Handle moving through the playlist
+  handlePlaylist();
+
   // Handle Visualizations over UDP
   /*
     Parse the UDP Packet. This is required to be called in the loop every time
@@ -70,19 +92,22 @@ void Light::loop() {
 
 void Light::identify() {
   // TODO: Figure out how to do this without delays
+  this->output.setBrightness(this->outputBrightness);
   fill_solid(this->leds, this->numLeds, CRGB::Green);
-  FastLED.show();
-  FastLED.delay(500);
+  this->output.apply(this->leds, this->leds, this->numLeds);
+  this->driver->show(this->leds, this->numLeds);
+  delay(500);
   fill_solid(this->leds, this->numLeds, CRGB::Black);
-  FastLED.show();
-  FastLED.delay(500);
+  this->driver->show(this->leds, this->numLeds);
+  delay(500);
   fill_solid(this->leds, this->numLeds, CRGB::Green);
-  FastLED.show();
-  FastLED.delay(500);
+  this->output.apply(this->leds, this->leds, this->numLeds);
+  this->driver->show(this->leds, this->numLeds);
+  delay(500);
   // TODO: make this return the light to it's previous state
   fill_solid(this->leds, this->numLeds, CRGB::Black);
-  FastLED.show();
-  FastLED.delay(500);
+  this->driver->show(this->leds, this->numLeds);
+  delay(500);
 }
 
 void Light::turnOn() {
@@ -102,42 +127,200 @@ void Light::setBrightness(byte brightness) {
   } else {
     // If the lights are off, just set the brightness immediately. Don't need
     // to be fancy
-    FastLED.setBrightness(
-        map(this->targetBrightness, 0, 100, 0, this->maxBrightness));
+    this->outputBrightness =
+        map(this->targetBrightness, 0, 100, 0, this->maxBrightness);
     this->currentBrightness = this->targetBrightness;
   }
 }
 
 void Light::setColor(CRGB color) {
+  stopPlaylist();
   this->state.color = color;
   // Setting a color automatically turns the light on
   if (!this->state.on) {
     turnOn();
   }
   if (this->state.effect != NO_EFFECT) {
-    // If an effect is playing, just go straight to the color, no transition
-    this->state.effect = NO_EFFECT;
+    // If an effect is playing, crossfade from the effect to the color
+    crossfadeTo(NO_EFFECT);
     this->currentColor = color;
-    fill_solid(this->leds, this->numLeds, color);
-    FastLED.show();
   } else {
     transitionColorTo(color);
   }
 }
 
 void Light::setEffect(String effect) {
-  this->state.effect = effect;
+  stopPlaylist();
+  if (effect != this->state.effect) {
+    crossfadeTo(effect);
+  }
   this->state.color = CRGB(255, 255, 255);
-  // Clear the lights when setting an effect
-  fill_solid(this->leds, this->numLeds, CRGB::Black);
-  FastLED.show();
   // Setting an effect automatically turns the light on
   if (!this->state.on) {
     turnOn();
   }
 }
 
-void Light::setSpeed(byte speed) { this->state.speed = speed; }
+void Light::setSpeed(float speed) {
+  this->state.speed = constrain(speed, MIN_SPEED, MAX_SPEED);
+}
+
+void Light::setCrossfadeTime(unsigned long crossfadeTime) {
+  // Never divide by zero when working out the blend amount
+  this->crossfadeTime = max(crossfadeTime, 1UL);
+}
+
+void Light::setColorCorrection(float gamma, CRGB whitePoint) {
+  this->output.setGamma(gamma);
+  this->output.setWhitePoint(whitePoint);
+}
+
+bool Light::setStream(char* multicastGroup, int sliceOffset, int sliceLength,
+                      int canvasLength) {
+  this->sliceOffset = max(sliceOffset, 0);
+  this->sliceLength =
+      sliceLength > 0 ? min(sliceLength, this->numLeds) : this->numLeds;
+  // Frames have to be exactly the canvas, so it has to hold the slice
+  int sliceEnd = this->sliceOffset + this->sliceLength;
+  if (canvasLength > 0 && canvasLength < sliceEnd) {
+    LOG_WARNING("The canvas is shorter than the slice, using %i leds",
+                sliceEnd);
+  }
+  this->canvasLength = max(canvasLength, sliceEnd);
+  LOG_INFO("Streaming leds %i-%i of a %i led canvas", this->sliceOffset,
+           sliceEnd - 1, this->canvasLength);
+
+  // Without a group, keep listening for unicast streams only
+  if (multicastGroup[0] == '\0') {
+    return true;
+  }
+  IPAddress group;
+  if (!group.fromString(multicastGroup) || group[0] < 224 || group[0] > 239) {
+    LOG_ERROR("%s is not a multicast address", multicastGroup);
+    return false;
+  }
+  // Unicast packets to our own address still arrive after joining the group
+  port.stop();
+  if (!port.beginMulticast(WiFi.localIP(), group, this->localPort)) {
+    LOG_ERROR("Failed to join multicast group %s", multicastGroup);
+    port.begin(this->localPort);
+    return false;
+  }
+  LOG_INFO("Joined multicast group %s:%u", multicastGroup, this->localPort);
+  return true;
+}
+
+bool Light::setMatrix(int width, int height, bool serpentine, int rotation,
+                      char* origin) {
+  if (width <= 0 || height <= 0) {
+    return false;
+  }
+  if (width * height > this->numLeds) {
+    LOG_ERROR("%ix%i matrix needs more than %i leds", width, height,
+              this->numLeds);
+    return false;
+  }
+  if (rotation != 0 && rotation != 90 && rotation != 180 && rotation != 270) {
+    LOG_ERROR("Matrix rotation must be 0, 90, 180 or 270, not %i", rotation);
+    return false;
+  }
+  bool originRight = strcmp(origin, "topRight") == 0 ||
+                     strcmp(origin, "bottomRight") == 0;
+  bool originBottom = strcmp(origin, "bottomLeft") == 0 ||
+                      strcmp(origin, "bottomRight") == 0;
+  if (!originRight && !originBottom && strcmp(origin, "topLeft") != 0) {
+    LOG_ERROR("Matrix origin must be topLeft, topRight, bottomLeft or "
+              "bottomRight, not %s",
+              origin);
+    return false;
+  }
+
+  // Rotating by 90 or 270 degrees turns columns into rows
+  bool swapAxes = rotation == 90 || rotation == 270;
+  this->matrixWidth = swapAxes ? height : width;
+  this->matrixHeight = swapAxes ? width : height;
+
+  // Walk the leds in the order they are wired and work out where each one
+  // ends up in the matrix, so effects never have to do this per frame
+  for (int i = 0; i < width * height; i++) {
+    int row = i / width;
+    int col = i % width;
+    if (serpentine && row % 2 == 1) {
+      col = width - 1 - col;
+    }
+    if (originRight) {
+      col = width - 1 - col;
+    }
+    if (originBottom) {
+      row = height - 1 - row;
+    }
+
+    int x, y;
+    switch (rotation) {
+      case 90:
+        x = height - 1 - row;
+        y = col;
+        break;
+      case 180:
+        x = width - 1 - col;
+        y = height - 1 - row;
+        break;
+      case 270:
+        x = row;
+        y = width - 1 - col;
+        break;
+      default:
+        x = col;
+        y = row;
+        break;
+    }
+    this->xyTable[y * this->matrixWidth + x] = i;
+  }
+
+  LOG_INFO("Using a %ix%i matrix", this->matrixWidth, this->matrixHeight);
+  updateEffectList();
+  return true;
+}
+
+void Light::setPlaylist(PlaylistEntry* entries, byte numEntries) {
+  if (numEntries == 0) {
+    stopPlaylist();
+    return;
+  }
+
+  this->playlistLength = min(numEntries, (byte)MAX_PLAYLIST_ENTRIES);
+  // Each entry has to last longer than the crossfade into it, otherwise the
+  // playlist advances (and publishes the state) every loop
+  unsigned long minDuration = max(MIN_PLAYLIST_DURATION, this->crossfadeTime);
+  for (int i = 0; i < this->playlistLength; i++) {
+    this->playlist[i] = entries[i];
+    if (this->playlist[i].duration < minDuration) {
+      LOG_WARNING("Playlist entry %i is too short, using %lu ms", i,
+                  minDuration);
+      this->playlist[i].duration = minDuration;
+    }
+  }
+  this->playlistIndex = 0;
+  this->state.playlist = true;
+  applyPlaylistEntry();
+  // Starting a playlist automatically turns the light on
+  if (!this->state.on) {
+    turnOn();
+  }
+}
+
+void Light::stopPlaylist() { this->state.playlist = false; }
+
+void Light::onStateChange(void (*callback)()) {
+  this->stateChangeCallback = callback;
+}
+
+void Light::onShow(void (*callback)()) { this->showCallback = callback; }
+
+bool Light::isTransitioning() {
+  return this->inBrightnessTransition || this->inColorTransition ||
+         this->inCrossfade;
+}
 
 LightState Light::getState() { return this->state; }
 
@@ -145,6 +328,96 @@ unsigned int Light::getNumEffects() { return this->numEffects; }
 
 String* Light::getEffectList() { return this->effectList; }
 
+void Light::loadPrograms() {
+  uint8_t data[MAX_PROGRAM_LENGTH];
+  for (int slot = 0; slot < MAX_EFFECT_PROGRAMS; slot++) {
+    this->programs[slot].used = false;
+    unsigned int length = readEffectProgram(slot, data, sizeof(data));
+    // The budget depends on numLeds, which may have changed since the upload
+    if (length > 0 && parseEffectProgram(data, length, &this->programs[slot]) &&
+        this->programs[slot].codeLength > 0 &&
+        checkProgram(this->programs[slot])) {
+      this->programs[slot].used = true;
+      LOG_INFO("Loaded effect program %s", this->programs[slot].name);
+    }
+  }
+  updateEffectList();
+}
+
+bool Light::checkProgram(const EffectProgram& program) {
+  // Programs can't replace the built in effects
+  if (strcmp(program.name, NO_EFFECT) == 0) {
+    LOG_ERROR("Effect program name is reserved");
+    return false;
+  }
+  for (int i = 0; i < NUM_BUILTIN_EFFECTS; i++) {
+    if (this->effectList[i] == program.name) {
+      LOG_ERROR("Effect program name is reserved");
+      return false;
+    }
+  }
+  for (int i = 0; i < NUM_MATRIX_EFFECTS; i++) {
+    if (this->MATRIX_EFFECTS[i] == program.name) {
+      LOG_ERROR("Effect program name is reserved");
+      return false;
+    }
+  }
+
+  // Make sure the program can render a full frame in time
+  if ((unsigned long)program.cost * this->numLeds > PROGRAM_FRAME_BUDGET) {
+    LOG_ERROR("Effect program %s is too slow (cost %u/pixel, max %u)",
+              program.name, program.cost, PROGRAM_FRAME_BUDGET / this->numLeds);
+    return false;
+  }
+  return true;
+}
+
+bool Light::addProgram(const uint8_t* data, unsigned int length) {
+  EffectProgram program;
+  if (!parseEffectProgram(data, length, &program) || !checkProgram(program)) {
+    return false;
+  }
+
+  int slot = findProgram(program.name);
+
+  // An empty program removes the effect
+  if (program.codeLength == 0) {
+    if (slot < 0) {
+      LOG_WARNING("No effect program named %s", program.name);
+      return false;
+    }
+    this->programs[slot].used = false;
+    deleteEffectProgram(slot);
+    updateEffectList();
+    if (this->state.effect == program.name) {
+      setColor(this->state.color);
+    }
+    LOG_INFO("Removed effect program %s", program.name);
+    return true;
+  }
+
+  if (slot < 0) {
+    for (int i = 0; i < MAX_EFFECT_PROGRAMS; i++) {
+      if (!this->programs[i].used) {
+        slot = i;
+        break;
+      }
+    }
+  }
+  if (slot < 0) {
+    LOG_ERROR("No free effect program slots");
+    return false;
+  }
+
+  program.used = true;
+  this->programs[slot] = program;
+  saveEffectProgram(slot, data, length);
+  updateEffectList();
+  LOG_INFO("Added effect program %s (cost %u/pixel)", program.name,
+           program.cost);
+  return true;
+}
+
 //************************************************************************
 // Transitions
 //************************************************************************
@@ -206,8 +479,8 @@ void Light::handleBrightnessTransition() {
                     this->currentBrightnessStep, BRIGHTNESS_TRANSITION_STEPS);
 
       // Set the value and increment the step;
-      FastLED.setBrightness(
-          map(this->currentBrightness, 0, 100, 0, this->maxBrightness));
+      this->outputBrightness =
+          map(this->currentBrightness, 0, 100, 0, this->maxBrightness);
       this->currentBrightnessStep++;
     }
 
@@ -216,7 +489,7 @@ void Light::handleBrightnessTransition() {
       this->inBrightnessTransition = false;
       // We call show here because Light::shouldShowLeds won't trigger on the
       // last iteration since we set inBrightnessTransition to false
-      FastLED.show();
+      showLeds();
       // Serial.println("Ending Brightness Transition: ");
       // Serial.printf("Current Brightness: %i\n", this->currentBrightness);
       // Serial.printf("target Brightness: %i\n", this->targetBrightness);
@@ -268,8 +541,7 @@ void Light::handleColorTransition() {
           getChange(this->blueStepAmount, this->blueRemainderAmount,
                     this->currentColorStep, COLOR_TRANSITION_STEPS);
 
-      // Set the value and increment the step;
-      fill_solid(this->leds, this->numLeds, this->currentColor);
+      // Increment the step. The color gets drawn in Light::showLeds
       this->currentColorStep++;
 
       // If we have gone through all the steps, end the transition
@@ -277,7 +549,7 @@ void Light::handleColorTransition() {
         this->inColorTransition = false;
         // We call show here because Light::shouldShowLeds won't trigger on the
         // last iteration since we set inColorTransition to false
-        FastLED.show();
+        showLeds();
         // Serial.println("Ending Color Transition: ");
         // Serial.printf("Current Red: %i, Current Green: %i, Current Blue:
         // %i\n",
@@ -291,16 +563,130 @@ void Light::handleColorTransition() {
   }
 }
 
+// Crossfade
+void Light::crossfadeTo(String effect) {
+  if (this->inCrossfade) {
+    // Freeze the half finished crossfade and fade out of that instead so the
+    // leds don't jump. leds is already color corrected, so blend the layers
+    // again instead of copying it
+    unsigned long elapsed =
+        min(millis() - this->crossfadeStartTime, this->crossfadeTime);
+    fract8 amount = (elapsed * 255) / this->crossfadeTime;
+    if (this->fadeEffect == NO_EFFECT) {
+      fill_solid(this->fadeLeds, this->numLeds, this->fadeColor);
+    }
+    blend(this->fadeLeds, this->effectLeds, this->fadeLeds, this->numLeds,
+          amount);
+    this->fadeEffect = FROZEN_EFFECT;
+  } else {
+    // The current effect keeps rendering into its own layer as the outgoing
+    // effect
+    CRGB* outgoingLeds = this->effectLeds;
+    this->effectLeds = this->fadeLeds;
+    this->fadeLeds = outgoingLeds;
+    this->fadeEffect = this->state.effect;
+    this->fadeColor = this->currentColor;
+    this->fadeStartTime = this->effectStartTime;
+  }
+
+  // A crossfade replaces any step transition that was in progress
+  this->startColorTransition = false;
+  this->inColorTransition = false;
+
+  this->state.effect = effect;
+  this->effectStartTime = millis();
+  fill_solid(this->effectLeds, this->numLeds, CRGB::Black);
+  this->inCrossfade = true;
+  this->crossfadeStartTime = millis();
+}
+
+void Light::handleCrossfade() {
+  unsigned long elapsed = millis() - this->crossfadeStartTime;
+  if (elapsed >= this->crossfadeTime) {
+    this->inCrossfade = false;
+    this->output.apply(this->effectLeds, this->leds, this->numLeds);
+    return;
+  }
+
+  if (this->fadeEffect == NO_EFFECT) {
+    fill_solid(this->fadeLeds, this->numLeds, this->fadeColor);
+  }
+  // One blend per pixel, so this costs about as much as a single fill no
+  // matter how many leds there are
+  fract8 amount = (elapsed * 255) / this->crossfadeTime;
+  blend(this->fadeLeds, this->effectLeds, this->leds, this->numLeds, amount);
+  this->output.apply(this->leds, this->leds, this->numLeds);
+}
+
+//************************************************************************
+// Playlists
+//************************************************************************
+void Light::applyPlaylistEntry() {
+  PlaylistEntry& entry = this->playlist[this->playlistIndex];
+  this->playlistStepTime = millis();
+
+  if (entry.effect == NO_EFFECT) {
+    if (this->state.effect == NO_EFFECT && !this->inCrossfade) {
+      this->state.color = entry.color;
+      transitionColorTo(entry.color);
+      return;
+    }
+    crossfadeTo(NO_EFFECT);
+    this->state.color = entry.color;
+    this->currentColor = entry.color;
+  } else if (entry.effect != this->state.effect) {
+    crossfadeTo(entry.effect);
+    this->state.color = CRGB(255, 255, 255);
+  }
+}
+
+void Light::handlePlaylist() {
+  if (!this->state.playlist) {
+    return;
+  }
+
+  unsigned long now = millis();
+  if (now - this->playlistStepTime <
+      this->playlist[this->playlistIndex].duration) {
+    return;
+  }
+
+  this->playlistIndex = (this->playlistIndex + 1) % this->playlistLength;
+  applyPlaylistEntry();
+  if (this->stateChangeCallback) {
+    this->stateChangeCallback();
+  }
+}
+
 //************************************************************************
 // Effects
 //************************************************************************
 // General
+void Light::updateEffectList() {
+  this->numEffects = NUM_BUILTIN_EFFECTS;
+  if (this->matrixWidth > 0) {
+    for (int i = 0; i < NUM_MATRIX_EFFECTS; i++) {
+      this->effectList[this->numEffects++] = this->MATRIX_EFFECTS[i];
+    }
+  }
+  for (int slot = 0; slot < MAX_EFFECT_PROGRAMS; slot++) {
+    if (this->programs[slot].used) {
+      this->effectList[this->numEffects++] = this->programs[slot].name;
+    }
+  }
+}
+
 bool Light::shouldShowLeds() {
   // If you are in a brightness transition, show leds
   if (this->inBrightnessTransition) {
     return true;
   }
 
+  // If you are crossfading between effects, show leds
+  if (this->inCrossfade) {
+    return true;
+  }
+
   // If you are in a color transition, show leds
   if (this->inColorTransition) {
     return true;
@@ -320,10 +706,59 @@ void Light::handleShowLeds() {
   }
 
   unsigned long now = millis();
-  // If its time to take a step
-  if (now - this->lastShowLedsTime > 1000 / FRAMES_PER_SECOND) {
+  // If its time to take a step and the last frame has finished sending
+  if (now - this->lastShowLedsTime > 1000 / FRAMES_PER_SECOND &&
+      this->driver->canShow()) {
     this->lastShowLedsTime = now;
-    FastLED.show();
+    showLeds();
+  }
+}
+
+void Light::showLeds() {
+  unsigned long renderStart = micros();
+  // A solid color is rendered here instead of on the effect timer so color
+  // transitions step at the frame rate
+  if (this->state.effect == NO_EFFECT) {
+    fill_solid(this->effectLeds, this->numLeds, this->currentColor);
+  }
+
+  // Color correction, brightness and color order all happen in the output
+  // stage on the way into leds. Its tables only get rebuilt when the
+  // brightness actually changed
+  this->output.setBrightness(this->outputBrightness);
+  if (this->inCrossfade) {
+    handleCrossfade();
+  } else {
+    this->output.apply(this->effectLeds, this->leds, this->numLeds);
+  }
+
+  unsigned long showStart = micros();
+  this->driver->show(this->leds, this->numLeds);
+  unsigned long showEnd = micros();
+  this->streamRenderTime += showStart - renderStart;
+  this->streamShowTime += showEnd - showStart;
+  this->streamShows++;
+#if PRINT_SHOW_TIMING
+  this->showTime += showEnd - showStart;
+  this->showFrames++;
+  if (millis() - this->showTimer >= 1000U) {
+    this->showTimer = millis();
+    LOG_INFO("Show: %u FPS, %lu us/frame, %i leds", this->showFrames,
+             this->showTime / this->showFrames, this->numLeds);
+    this->showTime = 0;
+    this->showFrames = 0;
+  }
+#endif
+  if (this->showCallback) {
+    this->showCallback();
+  }
+  // Only the first show of each streamed frame counts as showing it
+  if (!this->streamFrameShown && this->state.effect == "Visualize") {
+    this->streamFrameShown = true;
+    this->streamShown++;
+#if STREAM_ECHO
+    sendStreamEcho('S');
+#endif
   }
 }
 
@@ -334,153 +769,218 @@ bool Light::shouldUpdateEffect() {
     return false;
   }
 
-  String currentEffect = this->state.effect;
+  // Effects render from elapsed time, so they only need updating once per
+  // frame no matter how fast they move
+  return millis() - this->lastUpdateEffectTime >= 1000 / FRAMES_PER_SECOND;
+}
 
-  // ADD_EFFECT: Add the appropriate update threshold if the default speeds are
-  // inadequate
-  unsigned long updateThreshold;
-  if (currentEffect == "Flash") {
-    updateThreshold = this->FLASH_SPEEDS[this->state.speed - 1];
-  } else if (currentEffect == "Juggle" || currentEffect == "Fire" ||
-             currentEffect == "Blue Noise") {
-    updateThreshold = 17;
-  } else {
-    updateThreshold = this->DEFAULT_SPEEDS[this->state.speed - 1];
+void Light::handleEffect() {
+  if (!shouldUpdateEffect()) {
+    return;
   }
 
   unsigned long now = millis();
-  if (now - this->lastUpdateEffectTime > updateThreshold) {
-    this->lastUpdateEffectTime = now;
-    return true;
+  // Anything longer was the light being off rather than a slow frame, so
+  // don't jump ahead when it comes back on
+  float elapsed = min(now - this->lastUpdateEffectTime, 1000UL);
+  this->lastUpdateEffectTime = now;
+
+  unsigned long renderStart = micros();
+  cycleHue(elapsed / getStepTime(this->state.effect));
+  renderEffect(this->state.effect, this->effectLeds, this->effectStartTime,
+               elapsed);
+  // Keep the outgoing effect animating until the crossfade is over
+  if (this->inCrossfade) {
+    renderEffect(this->fadeEffect, this->fadeLeds, this->fadeStartTime,
+                 elapsed);
   }
-  return false;
+  this->streamRenderTime += micros() - renderStart;
 }
 
-void Light::handleEffect() {
-  String currentEffect = this->state.effect;
-  if (currentEffect == NO_EFFECT) {
-    return;
+float Light::getStepTime(String effect) {
+  // ADD_EFFECT: Add the step time if the default speeds are inadequate
+  if (effect == "Flash") {
+    return interpolateSpeed(this->FLASH_SPEEDS);
+  } else if (effect == "Juggle" || effect == "Fire" || effect == "Blue Noise" ||
+             effect == "Fire 2D" || effect == "Noise 2D" ||
+             findProgram(effect) >= 0) {
+    return FRAME_STEP_TIME;
   }
+  return interpolateSpeed(this->DEFAULT_SPEEDS);
+}
 
-  if (!shouldUpdateEffect()) {
-    return;
-  }
+float Light::interpolateSpeed(const int table[7]) {
+  // Speeds between the whole numbers land between the table entries
+  float position = constrain(this->state.speed, MIN_SPEED, MAX_SPEED) - 1;
+  int index = min((int)position, 5);
+  float fraction = position - index;
+  return table[index] + (table[index + 1] - table[index]) * fraction;
+}
+
+byte Light::getFadeAmount(byte fadePerStep, float steps) {
+  // Fading by the same amount step after step compounds, so work out what
+  // that adds up to over a fraction or several steps
+  float remaining = powf(1 - fadePerStep / 256.0, steps);
+  return 255 - (byte)(remaining * 255);
+}
+
+void Light::renderEffect(String effect, CRGB* leds, unsigned long startTime,
+                         float elapsed) {
+  // How far the effect moved, in steps of the old fixed update rate, so every
+  // effect still runs at the speed it used to
+  float steps = elapsed / getStepTime(effect);
 
   // ADD_EFFECT: Add the effect to this handler
-  if (currentEffect == "Flash") {
-    handleFlash();
-  } else if (currentEffect == "Fade") {
-    handleFade();
-  } else if (currentEffect == "Confetti") {
-    handleConfetti();
-  } else if (currentEffect == "Juggle") {
-    handleJuggle();
-  } else if (currentEffect == "Rainbow") {
-    handleRainbow();
-  } else if (currentEffect == "Cylon") {
-    handleCylon();
-  } else if (currentEffect == "Fire") {
-    handleFire();
-  } else if (currentEffect == "Blue Noise") {
-    handleBlueNoise();
-  }
-}
-
-void Light::cycleHue() { this->gHue++; }
+  if (effect == "Flash") {
+    handleFlash(leds, steps);
+  } else if (effect == "Fade") {
+    handleFade(leds);
+  } else if (effect == "Confetti") {
+    handleConfetti(leds, steps);
+  } else if (effect == "Juggle") {
+    handleJuggle(leds, steps);
+  } else if (effect == "Rainbow") {
+    handleRainbow(leds);
+  } else if (effect == "Cylon") {
+    handleCylon(leds, steps);
+  } else if (effect == "Fire") {
+    handleFire(leds, steps);
+  } else if (effect == "Blue Noise") {
+    handleBlueNoise(leds, steps);
+  } else if (effect == "Visualize") {
+    handleStreamInterpolation(leds);
+  } else if (effect == "Fire 2D" && this->matrixWidth > 0) {
+    handleFire2D(leds, steps);
+  } else if (effect == "Noise 2D" && this->matrixWidth > 0) {
+    handleNoise2D(leds, steps);
+  } else if (effect == "Rainbow 2D" && this->matrixWidth > 0) {
+    handleRainbow2D(leds);
+  } else {
+    int slot = findProgram(effect);
+    if (slot >= 0) {
+      handleProgram(slot, leds, startTime);
+    }
+  }
+}
+
+void Light::cycleHue(float steps) {
+  this->huePhase = fmod(this->huePhase + steps, 256);
+  this->gHue = this->huePhase;
+}
 
 // Flash
-void Light::handleFlash() {
-  switch (this->flashColor) {
+void Light::handleFlash(CRGB* leds, float steps) {
+  this->flashPhase = fmod(this->flashPhase + steps, 3);
+  switch ((int)this->flashPhase) {
     case 0: {
-      fill_solid(this->leds, this->numLeds, CRGB::Red);
-      this->flashColor = 1;
+      fill_solid(leds, this->numLeds, CRGB::Red);
       break;
     }
     case 1: {
-      fill_solid(this->leds, this->numLeds, CRGB::Green);
-      this->flashColor = 2;
+      fill_solid(leds, this->numLeds, CRGB::Green);
       break;
     }
-    case 2: {
-      fill_solid(this->leds, this->numLeds, CRGB::Blue);
-      this->flashColor = 0;
+    default: {
+      fill_solid(leds, this->numLeds, CRGB::Blue);
       break;
     }
   }
 }
 
 // Fade
-void Light::handleFade() {
-  cycleHue();
-  fill_solid(this->leds, this->numLeds, CHSV(gHue, 255, 255));
+void Light::handleFade(CRGB* leds) {
+  fill_solid(leds, this->numLeds, CHSV(gHue, 255, 255));
 }
 
 // Confetti
-void Light::handleConfetti() {
-  cycleHue();
-  fadeToBlackBy(this->leds, this->numLeds, 10);
-  int pos = random16(this->numLeds);
-  this->leds[pos] += CHSV(gHue + random8(64), 200, 255);
+void Light::handleConfetti(CRGB* leds, float steps) {
+  fadeToBlackBy(leds, this->numLeds, getFadeAmount(10, steps));
+  // One new dot per step, so keep the fractions until they add up to a dot
+  this->confettiPhase = min(this->confettiPhase + steps, (float)this->numLeds);
+  while (this->confettiPhase >= 1) {
+    this->confettiPhase--;
+    int pos = random16(this->numLeds);
+    leds[pos] += CHSV(gHue + random8(64), 200, 255);
+  }
 }
 
 // Juggle
-void Light::handleJuggle() {
+void Light::handleJuggle(CRGB* leds, float steps) {
   // eight colored dots, weaving in and out of sync with each other
-  fadeToBlackBy(this->leds, this->numLeds,
-                this->JUGGLE_FADE[this->state.speed - 1]);
+  fadeToBlackBy(leds, this->numLeds,
+                getFadeAmount(interpolateSpeed(this->JUGGLE_FADE), steps));
+  // beatsin88 takes the BPM in 1/256ths so speeds between the table entries
+  // still change the BPM
+  accum88 bpmAdder = interpolateSpeed(this->JUGGLE_BPMS_ADDER) * 256;
   byte dothue = 0;
   for (int i = 0; i < 8; i++) {
-    this->leds[beatsin16(i + this->JUGGLE_BPMS_ADDER[this->state.speed - 1], 0,
-                         this->numLeds - 1)] |= CHSV(dothue, 200, 255);
+    leds[beatsin88(i * 256 + bpmAdder, 0, this->numLeds - 1)] |=
+        CHSV(dothue, 200, 255);
     dothue += 32;
   }
 }
 
 // Rainbow
-void Light::handleRainbow() {
-  cycleHue();
+void Light::handleRainbow(CRGB* leds) {
   // The shorter the last number, the longer each color is on the rainbow
-  fill_rainbow(this->leds, this->numLeds, this->gHue, 3);
+  fill_rainbow(leds, this->numLeds, this->gHue, 3);
 }
 
 // Cylon
-void Light::handleCylon() {
-  cycleHue();
-  for (int i = 0; i < this->numLeds; i++) {
-    this->leds[i].nscale8(247);
-  }
-  // First slide the led in one direction
-  if (this->cylonLed >= this->numLeds - 1) {
-    this->cylonForward = false;
-  } else if (this->cylonLed <= 0) {
-    this->cylonForward = true;
-  }
-  if (this->cylonForward) {
-    this->cylonLed++;
-  } else {
-    this->cylonLed--;
+int Light::getCylonLed(float phase) {
+  // The phase goes from one end to the other and back again
+  int travel = max(this->numLeds - 1, 1);
+  int led = phase < travel ? phase : 2 * travel - phase;
+  return min(led, this->numLeds - 1);
+}
+
+void Light::handleCylon(CRGB* leds, float steps) {
+  fadeToBlackBy(leds, this->numLeds, getFadeAmount(8, steps));
+
+  int travel = max(this->numLeds - 1, 1);
+  // Light every led passed since the last frame so fast speeds still leave a
+  // solid trail
+  float phase = this->cylonPhase;
+  float target = phase + min(steps, (float)(2 * travel));
+  for (phase += 1; phase < target; phase += 1) {
+    leds[getCylonLed(fmod(phase, 2 * travel))] = CHSV(this->gHue, 255, 255);
   }
-  this->leds[this->cylonLed] = CHSV(this->gHue, 255, 255);
+  this->cylonPhase = fmod(target, 2 * travel);
+  leds[getCylonLed(this->cylonPhase)] = CHSV(this->gHue, 255, 255);
 }
 
 // Fire
-void Light::handleFire() {
+int Light::getFireSteps(float* phase, float steps) {
+  // The simulation only looks right at its own rate, so run it a whole step
+  // at a time. After a stall, skip ahead instead of running every missed step
+  *phase += steps;
+  int wholeSteps = *phase;
+  *phase -= wholeSteps;
+  return min(wholeSteps, MAX_FIRE_STEPS);
+}
+
+void Light::stepFire(byte* heat, int numCells) {
   // Step 1.  Cool down every cell a little
-  for (int i = 0; i < this->numLeds; i++) {
-    this->heat[i] = qsub8(
-        this->heat[i], random8(0, ((this->COOLING * 10) / this->numLeds) + 2));
+  for (int i = 0; i < numCells; i++) {
+    heat[i] = qsub8(heat[i], random8(0, ((this->COOLING * 10) / numCells) + 2));
   }
 
   // Step 2.  Heat from each cell drifts 'up' and diffuses a little
-  for (int k = this->numLeds - 1; k >= 2; k--) {
-    this->heat[k] =
-        (this->heat[k - 1] + this->heat[k - 2] + this->heat[k - 2]) / 3;
+  for (int k = numCells - 1; k >= 2; k--) {
+    heat[k] = (heat[k - 1] + heat[k - 2] + heat[k - 2]) / 3;
   }
 
-  // Step 3.  Randomly ignite new 'sparks' of this->heat near the bottom
+  // Step 3.  Randomly ignite new 'sparks' of heat near the bottom
   if (random8() < this->SPARKING) {
-    int y = random8(7);
-    this->heat[y] = qadd8(this->heat[y], random8(160, 255));
+    int y = random8(min(numCells, 7));
+    heat[y] = qadd8(heat[y], random8(160, 255));
+  }
+}
+
+void Light::handleFire(CRGB* leds, float steps) {
+  int fireSteps = getFireSteps(&this->firePhase, steps);
+  for (int i = 0; i < fireSteps; i++) {
+    stepFire(this->heat, this->numLeds);
   }
 
   // Step 4.  Map from this->heat cells to LED colors
@@ -495,12 +995,12 @@ void Light::handleFire() {
     } else {
       pixelnumber = j;
     }
-    this->leds[pixelnumber] = color;
+    leds[pixelnumber] = color;
   }
 }
 
 // Blue Noise
-void Light::handleBlueNoise() {
+void Light::handleBlueNoise(CRGB* leds, float steps) {
   // Just one loop to fill up the LED array as all of the pixels change.
   for (int i = 0; i < this->numLeds; i++) {
     // Get a value from the noise function. I'm using both x and y axis.
@@ -508,35 +1008,278 @@ void Light::handleBlueNoise() {
         inoise8(i * this->scale, this->dist + i * this->scale) % 255;
     // With that value, look up the 8 bit colour palette
     // value and assign it to the current LED.
-    this->leds[i] = ColorFromPalette(OceanColors_p, index, 255, LINEARBLEND);
+    leds[i] = ColorFromPalette(OceanColors_p, index, 255, LINEARBLEND);
   }
   // Moving along the distance (that random number we started out with). Vary it
   // a bit with a sine wave.
-  this->dist += beatsin8(10, 2, 5);
+  this->distPhase =
+      fmod(this->distPhase + beatsin8(10, 2, 5) * steps, 65536);
+  this->dist = this->distPhase;
 }
 
 void Light::handleVisualize(int packetSize) {
-  unsigned int expectedPacketSize = this->numLeds * 3;
-  // If packets have been received, interpret the command
-  if (packetSize == expectedPacketSize) {
-    port.read((char*)this->leds, sizeof(this->leds));
+  if (packetSize > 0 && readStreamFrame(packetSize)) {
 #if PRINT_FPS
     this->fpsCounter++;
-    Serial.print("/");  // Monitors connection(shows jumps/jitters in packets)
 #endif
-  } else if (packetSize) {
-    Serial.printf("Invalid packet size: %u (expected %u)\n", packetSize,
-                  expectedPacketSize);
-    port.flush();
-    return;
   }
+  handleStreamReport();
 
 #if PRINT_FPS
   if (millis() - this->secondTimer >= 1000U) {
     this->secondTimer = millis();
-    Serial.printf("FPS: %d\n", this->fpsCounter);
+    LOG_DEBUG("FPS: %d", this->fpsCounter);
     this->fpsCounter = 0;
   }
 #endif
 }
+
+bool Light::readStreamFrame(int packetSize) {
+  // Reports go back to whoever is sending
+  this->streamSourceIP = port.remoteIP();
+  this->streamSourcePort = port.remotePort();
+  this->streamPacketTime = millis();
+
+  // A frame is exactly the canvas, with or without the header in front. The
+  // length says which, so pixels that happen to spell the magic are still
+  // pixels
+  unsigned int size = packetSize;
+  unsigned int frameSize = this->canvasLength * 3;
+  bool hasHeader = size == frameSize + STREAM_HEADER_SIZE;
+  if (size != frameSize && !hasHeader) {
+    LOG_WARNING("Invalid packet size: %u (expected %u or %u)", size,
+                frameSize, frameSize + STREAM_HEADER_SIZE);
+    port.flush();
+    this->streamDropped++;
+    return false;
+  }
+  byte header[STREAM_HEADER_SIZE];
+  unsigned int position = 0;  // Bytes of the packet read so far
+  if (hasHeader) {
+    position = port.read(header, STREAM_HEADER_SIZE);
+    if (position != STREAM_HEADER_SIZE ||
+        memcmp(header, STREAM_MAGIC, 4) != 0) {
+      LOG_WARNING("Invalid stream header");
+      port.flush();
+      this->streamDropped++;
+      return false;
+    }
+  }
+
+  // A multicast stream carries one canvas for many lights, so only read this
+  // light's slice of it. The rest is dropped by the next parsePacket
+  unsigned int sliceStart = position + this->sliceOffset * 3;
+  unsigned int sliceSize = this->sliceLength * 3;
+
+  unsigned long now = millis();
+  // A long gap means the sender may have restarted its sequence
+  bool newStream = now - this->streamFrameTime > STREAM_TIMEOUT;
+  bool interpolate = false;
+  if (hasHeader) {
+    uint16_t sequence = header[6] << 8 | header[7];
+    if (!newStream && (int16_t)(sequence - this->streamSequence) <= 0) {
+      LOG_DEBUG("Dropping late frame %u", sequence);
+      port.flush();
+      this->streamLate++;
+      return false;
+    }
+    this->streamSequence = sequence;
+    interpolate = header[4] & STREAM_FLAG_INTERPOLATE;
+  }
+
+  CRGB* frame = this->effectLeds;
+  if (interpolate) {
+    // Blend from whatever is showing now, so a frame that arrives early
+    // doesn't jump
+    memcpy(this->streamFrames[0], this->effectLeds, sliceSize);
+    frame = this->streamFrames[1];
+    // Each frame takes as long to blend in as the frames are apart, which is
+    // also the most it can be held back
+    unsigned long interval = newStream ? MAX_INTERPOLATION_TIME
+                                       : now - this->streamFrameTime;
+    this->streamInterval =
+        constrain((3 * this->streamInterval + interval) / 4,
+                  1000UL / FRAMES_PER_SECOND, MAX_INTERPOLATION_TIME);
+  }
+  this->interpolating = interpolate;
+  this->streamFrameTime = now;
+
+  // WiFiUDP can't seek, so skip to the slice in chunks
+  while (position < sliceStart) {
+    int read = port.read(this->packetBuffer,
+                         min(sliceStart - position, (unsigned int)BUFFER_LEN));
+    if (read <= 0) {
+      break;
+    }
+    position += read;
+  }
+  port.read((char*)frame, sliceSize);
+  this->streamReceived++;
+  this->streamFrameShown = false;
+#if STREAM_ECHO
+  memcpy(this->echoFrame, frame, sizeof(this->echoFrame));
+  sendStreamEcho('R');
+#endif
+  return true;
+}
+
+void writeUint16(byte* buffer, uint16_t value) {
+  buffer[0] = value >> 8;
+  buffer[1] = value;
+}
+
+void writeUint32(byte* buffer, uint32_t value) {
+  writeUint16(buffer, value >> 16);
+  writeUint16(buffer + 2, value);
+}
+
+void Light::handleStreamReport() {
+  unsigned long now = millis();
+  unsigned long interval = now - this->lastStreamReportTime;
+  if (interval < STREAM_REPORT_INTERVAL) {
+    return;
+  }
+  this->lastStreamReportTime = now;
+
+  // Only report while something is streaming. The layout is documented in
+  // README.md for other senders
+  if (this->streamSourcePort != 0 &&
+      now - this->streamPacketTime <= STREAM_TIMEOUT) {
+    byte report[STREAM_REPORT_SIZE];
+    memcpy(report, STREAM_REPORT_MAGIC, 4);
+    report[4] = STREAM_REPORT_VERSION;
+    report[5] = 0;
+    writeUint16(report + 6, this->streamSequence);
+    writeUint32(report + 8, interval);
+    writeUint32(report + 12, this->streamReceived);
+    writeUint32(report + 16, this->streamShown);
+    writeUint32(report + 20, this->streamDropped);
+    writeUint32(report + 24, this->streamLate);
+    writeUint32(report + 28, this->streamShows > 0
+                                 ? this->streamRenderTime / this->streamShows
+                                 : 0);
+    writeUint32(report + 32, this->streamShows > 0
+                                 ? this->streamShowTime / this->streamShows
+                                 : 0);
+    port.beginPacket(this->streamSourceIP, this->streamSourcePort);
+    port.write(report, sizeof(report));
+    port.endPacket();
+  }
+
+  this->streamReceived = 0;
+  this->streamShown = 0;
+  this->streamDropped = 0;
+  this->streamLate = 0;
+  this->streamRenderTime = 0;
+  this->streamShowTime = 0;
+  this->streamShows = 0;
+}
+
+void Light::handleStreamInterpolation(CRGB* leds) {
+  if (!this->interpolating) {
+    return;
+  }
+  unsigned long elapsed = millis() - this->streamFrameTime;
+  if (elapsed >= this->streamInterval) {
+    memcpy(leds, this->streamFrames[1], this->sliceLength * sizeof(CRGB));
+    this->interpolating = false;
+    return;
+  }
+  fract8 amount = elapsed * 256 / this->streamInterval;
+  blend(this->streamFrames[0], this->streamFrames[1], leds, this->sliceLength,
+        amount);
+}
+
+#if STREAM_ECHO
+void Light::sendStreamEcho(char type) {
+  // 'R' when a frame was received or 'S' when it was shown, followed by the
+  // frame number the sender put in pixel 0
+  port.beginPacket(this->streamSourceIP, this->streamSourcePort);
+  port.write(type);
+  port.write(this->echoFrame, sizeof(this->echoFrame));
+  port.endPacket();
+}
+#endif
+
+// Fire 2D
+void Light::handleFire2D(CRGB* leds, float steps) {
+  // Fire, but every column burns on its own from the bottom of the matrix
+  int height = this->matrixHeight;
+  int fireSteps = getFireSteps(&this->fire2DPhase, steps);
+  for (int x = 0; x < this->matrixWidth; x++) {
+    byte* column = &this->heat[x * height];
+    for (int i = 0; i < fireSteps; i++) {
+      stepFire(column, height);
+    }
+
+    // Step 4.  Map from heat cells to LED colors, bottom row first
+    for (int j = 0; j < height; j++) {
+      byte colorindex = scale8(column[j], 240);
+      leds[this->xyTable[(height - 1 - j) * this->matrixWidth + x]] =
+          ColorFromPalette(HeatColors_p, colorindex);
+    }
+  }
+}
+
+// Noise 2D
+void Light::handleNoise2D(CRGB* leds, float steps) {
+  int i = 0;
+  for (int y = 0; y < this->matrixHeight; y++) {
+    for (int x = 0; x < this->matrixWidth; x++) {
+      uint8_t index = inoise8(x * this->scale, y * this->scale, this->noiseZ);
+      leds[this->xyTable[i++]] =
+          ColorFromPalette(OceanColors_p, index, 255, LINEARBLEND);
+    }
+  }
+  // Move through the third dimension of the noise so the pattern evolves
+  // instead of scrolling
+  this->noisePhase =
+      fmod(this->noisePhase + beatsin8(10, 2, 5) * steps, 65536);
+  this->noiseZ = this->noisePhase;
+}
+
+// Rainbow 2D
+void Light::handleRainbow2D(CRGB* leds) {
+  // Diagonal bands of color moving across the matrix
+  int i = 0;
+  for (int y = 0; y < this->matrixHeight; y++) {
+    byte hue = this->gHue + y * 8;
+    for (int x = 0; x < this->matrixWidth; x++) {
+      leds[this->xyTable[i++]] = CHSV(hue, 255, 255);
+      hue += 8;
+    }
+  }
+}
+
+// Uploaded Programs
+int Light::findProgram(String name) {
+  for (int slot = 0; slot < MAX_EFFECT_PROGRAMS; slot++) {
+    if (this->programs[slot].used &&
+        strcmp(this->programs[slot].name, name.c_str()) == 0) {
+      return slot;
+    }
+  }
+  return -1;
+}
+
+void Light::handleProgram(int slot, CRGB* leds, unsigned long startTime) {
+#if PRINT_VM_TIMING
+  unsigned long renderStart = micros();
+#endif
+  runEffectProgram(this->programs[slot], leds, this->numLeds,
+                   millis() - startTime, (byte)(this->state.speed + 0.5),
+                   this->gHue);
+#if PRINT_VM_TIMING
+  this->programRenderTime += micros() - renderStart;
+  this->programFrames++;
+  if (millis() - this->programTimer >= 1000U) {
+    this->programTimer = millis();
+    LOG_INFO("VM: %lu us/frame, cost %u/pixel, %i leds",
+             this->programRenderTime / this->programFrames,
+             this->programs[slot].cost, this->numLeds);
+    this->programRenderTime = 0;
+    this->programFrames = 0;
+  }
+#endif
+}
 // ADD_EFFECT: Add the effect handler code below
\ No newline at end of file
@@ -7,6 +7,9 @@
 #include <Arduino.h>
 #define FASTLED_INTERNAL  // Disable pragma messages
 #include <FastLED.h>
+#include "EffectVM.h"
+#include "LedDriver.h"
+#include "OutputStage.h"
 
 #define NO_EFFECT "None"
 #define FRAMES_PER_SECOND 60
@@ -16,26 +19,83 @@
 #define BRIGHTNESS_TRANSITION_STEPS 30
 #define COLOR_TRANSITION_TIME 500
 #define COLOR_TRANSITION_STEPS 30
+#define CROSSFADE_TIME 1000
+#define MIN_SPEED 1
+#define MAX_SPEED 7
+// Effects that used to update every frame step at the frame rate
+#define FRAME_STEP_TIME (1000.0 / FRAMES_PER_SECOND)
+#define MAX_FIRE_STEPS 4
+#define MAX_PLAYLIST_ENTRIES 8
+#define MIN_PLAYLIST_DURATION 1000UL  // In ms, never shorter than crossfadeTime
+#define MAX_PLAYLIST_DURATION 86400L  // In seconds
+// Marks an outgoing layer that holds a still frame instead of an effect
+#define FROZEN_EFFECT ""
 // Maximum number of packets to hold in the buffer. Don't change this.
 #define BUFFER_LEN 1024
-// Toggles FPS output (1 = print FPS over serial, 0 = disable output)
+// Optional stream header: "PRYS", flags, reserved, 16 bit big endian sequence.
+// Frames with one are this much longer, which is how they're told apart
+#define STREAM_HEADER_SIZE 8
+#define STREAM_MAGIC "PRYS"
+#define STREAM_FLAG_INTERPOLATE 0x01
+#define STREAM_TIMEOUT 1000         // In ms, after which any sequence is new
+#define MAX_INTERPOLATION_TIME 100  // In ms, longest a frame takes to blend in
+// Stats report sent back to the stream source, see README.md
+#define STREAM_REPORT_MAGIC "PRYR"
+#define STREAM_REPORT_VERSION 1
+#define STREAM_REPORT_SIZE 36
+#define STREAM_REPORT_INTERVAL 1000  // In ms
+// Toggles FPS output (1 = log FPS at the debug level, 0 = disable output)
 #define PRINT_FPS 1
+// Toggles effect program timing output (1 = print render time over serial)
+#define PRINT_VM_TIMING 0
+// Toggles output timing (1 = print frames shown per second and the time spent
+// sending them over serial)
+#define PRINT_SHOW_TIMING 0
+// Toggles stream echo (1 = tell the stream source which frames were received
+// and shown, for tools/udpstream.py)
+#define STREAM_ECHO 0
+// ADD_EFFECT: Increment the number of built in effects
+#define NUM_BUILTIN_EFFECTS 9
+// Effects that only show up when a matrix layout is configured
+#define NUM_MATRIX_EFFECTS 3
 
 typedef struct {
   bool on;
   byte brightness;
   CRGB color;
   String effect;
-  byte speed;
+  float speed;  // 1-7, fractions are fine
+  bool playlist;
 } LightState;
 
+typedef struct {
+  String effect;  // NO_EFFECT shows color instead
+  CRGB color;
+  unsigned long duration;  // In ms
+} PlaylistEntry;
+
 class Light {
  private:
-  LightState state = {false, 100, CRGB(255, 0, 0), NO_EFFECT, 4};
-  // FastLED variables
-  CRGB leds[512];
+  LightState state = {false, 100, CRGB(255, 0, 0), NO_EFFECT, 4, false};
+  void (*stateChangeCallback)() = NULL;
+  void (*showCallback)() = NULL;
+  // Output variables
+  LedDriver* driver = NULL;
+  OutputStage output;
+  byte outputBrightness;
+  CRGB leds[MAX_LEDS];  // Color corrected frame in strip order
+  // Effects render into their own layer and get composited into leds, so the
+  // outgoing effect can keep animating while it fades out
+  CRGB layerLeds[2][MAX_LEDS];
+  CRGB* effectLeds = layerLeds[0];
+  CRGB* fadeLeds = layerLeds[1];
   int numLeds;
   byte maxBrightness;
+  // Matrix layout. Maps matrix order (row by row from the top left, after
+  // rotation) to the led index so 2D effects cost one lookup per pixel
+  uint16_t xyTable[MAX_LEDS];
+  int matrixWidth = 0;  // 0 when the leds aren't a matrix
+  int matrixHeight = 0;
   // Transitions: General
   int getStep(int start, int target, int numSteps);
   int getRemainder(int start, int target, int numSteps);
@@ -67,69 +127,161 @@ class Light {
   bool inColorTransition;
   void transitionColorTo(CRGB color);
   void handleColorTransition();
+  // Transitions: Crossfade
+  String fadeEffect = NO_EFFECT;
+  CRGB fadeColor;
+  unsigned long fadeStartTime = 0;
+  unsigned long effectStartTime = 0;
+  unsigned long crossfadeStartTime = 0;
+  unsigned long crossfadeTime = CROSSFADE_TIME;
+  bool inCrossfade = false;
+  void crossfadeTo(String effect);
+  void handleCrossfade();
+  // Playlists
+  PlaylistEntry playlist[MAX_PLAYLIST_ENTRIES];
+  byte playlistLength = 0;
+  byte playlistIndex = 0;
+  unsigned long playlistStepTime = 0;
+  void applyPlaylistEntry();
+  void handlePlaylist();
   // Effect List Variables
-  // ADD_EFFECT: Increment numEffects and add the effect to the list
-  unsigned int numEffects = 9;
-  String effectList[9] = {"Flash",   "Fade",  "Confetti", "Juggle",
-                          "Rainbow", "Cylon", "Fire",     "Blue Noise", "Visualize"};
+  // ADD_EFFECT: Add the effect to the list
+  unsigned int numEffects = NUM_BUILTIN_EFFECTS;
+  String effectList[NUM_BUILTIN_EFFECTS + NUM_MATRIX_EFFECTS +
+                    MAX_EFFECT_PROGRAMS] = {
+      "Flash", "Fade",  "Confetti",   "Juggle",   "Rainbow",
+      "Cylon", "Fire",  "Blue Noise", "Visualize"};
+  const String MATRIX_EFFECTS[NUM_MATRIX_EFFECTS] = {"Fire 2D", "Noise 2D",
+                                                     "Rainbow 2D"};
+  void updateEffectList();
   // Effects: General
   unsigned long lastShowLedsTime = 0;
   bool shouldShowLeds();
   void handleShowLeds();
+  void showLeds();
+#if PRINT_SHOW_TIMING
+  unsigned long showTime = 0;
+  uint16_t showFrames = 0;
+  uint32_t showTimer = 0;
+#endif
   const int DEFAULT_SPEEDS[7] = {200, 100, 50, 33, 20, 10, 4};  // In ms
   unsigned long lastUpdateEffectTime = 0;
   bool shouldUpdateEffect();
   void handleEffect();
+  float getStepTime(String effect);
+  float interpolateSpeed(const int table[7]);
+  byte getFadeAmount(byte fadePerStep, float steps);
+  void renderEffect(String effect, CRGB* leds, unsigned long startTime,
+                    float elapsed);
   byte gHue = 0;
-  void cycleHue();
+  float huePhase = 0;
+  void cycleHue(float steps);
   // Effects: Flash
   const int FLASH_SPEEDS[7] = {
       4000, 2000, 1000, 500, 350, 200, 100};  // In ms between color transitions
-  byte flashColor = 0;
-  void handleFlash();
+  float flashPhase = 0;
+  void handleFlash(CRGB* leds, float steps);
   // Effects: Fade
-  void handleFade();
+  void handleFade(CRGB* leds);
   // Effects: Confetti
-  void handleConfetti();
+  float confettiPhase = 0;
+  void handleConfetti(CRGB* leds, float steps);
   // Effects: Juggle
   const int JUGGLE_BPMS_ADDER[7] = {1, 4, 7, 10, 13, 17, 20};
   const int JUGGLE_FADE[7] = {20, 25, 30, 35, 40, 45, 50};
-  void handleJuggle();
+  void handleJuggle(CRGB* leds, float steps);
   // Effects: Rainbow
-  void handleRainbow();
+  void handleRainbow(CRGB* leds);
   // Effects: Cylon
-  int cylonLed = 0;
-  bool cylonForward = true;
-  void handleCylon();
+  float cylonPhase = 0;
+  int getCylonLed(float phase);
+  void handleCylon(CRGB* leds, float steps);
   // Effects: Fire
   const int COOLING = 55;
   const int SPARKING = 120;
   bool fireReverseDirection = false;  // make fire run from the other end
   CRGBPalette16 heatPalette;
-  byte heat[500];  // TODO: Figure out if i can dynamically allocate this memory
-  void handleFire();
+  // Shared with Fire 2D, which keeps one column of cells per matrix column
+  byte heat[MAX_LEDS];  // TODO: Figure out if i can dynamically allocate this memory
+  float firePhase = 0;
+  int getFireSteps(float* phase, float steps);
+  void stepFire(byte* heat, int numCells);
+  void handleFire(CRGB* leds, float steps);
   // Effects: Blue Noise
   uint16_t dist;        // A random number for our noise generator.
+  float distPhase = 0;
   uint16_t scale = 30;  // Wouldn't recommend changing this on the fly, or the
                         // animation will be really blocky.
   uint8_t maxChanges = 48;  // Value for blending between palettes.
   CRGBPalette16 targetPalette;
   CRGBPalette16 currentPalette;
-  void handleBlueNoise();
+  void handleBlueNoise(CRGB* leds, float steps);
   // Effects: Visualize
   unsigned int localPort = 7778;
+  // This light's slice of the stream, in leds
+  int sliceOffset = 0;
+  int sliceLength = 0;
+  int canvasLength = 0;  // Leds in every frame of the stream
   char packetBuffer[BUFFER_LEN];
   uint8_t N = 0;
 #if PRINT_FPS
   uint16_t fpsCounter = 0;
   uint32_t secondTimer = 0;
 #endif
+  // Where the last packet came from and what happened to the frames since the
+  // last report
+  IPAddress streamSourceIP;
+  uint16_t streamSourcePort = 0;
+  unsigned long streamPacketTime = 0;
+  bool streamFrameShown = true;
+  uint32_t streamReceived = 0;
+  uint32_t streamShown = 0;
+  uint32_t streamDropped = 0;  // Wrong size
+  uint32_t streamLate = 0;     // Older than a frame already received
+  unsigned long streamRenderTime = 0;  // In us
+  unsigned long streamShowTime = 0;
+  uint16_t streamShows = 0;
+  unsigned long lastStreamReportTime = 0;
+  void handleStreamReport();
+#if STREAM_ECHO
+  byte echoFrame[3];  // Pixel 0 of the last frame, which carries its number
+  void sendStreamEcho(char type);
+#endif
+  // Interpolating streams blend from the frame that was showing when the last
+  // one arrived into the last one
+  CRGB streamFrames[2][MAX_LEDS];
+  unsigned long streamFrameTime = 0;
+  unsigned long streamInterval = 1000 / FRAMES_PER_SECOND;
+  uint16_t streamSequence = 0;
+  bool interpolating = false;
   void handleVisualize(int packetSize);
+  bool readStreamFrame(int packetSize);
+  void handleStreamInterpolation(CRGB* leds);
+  // Effects: Fire 2D
+  float fire2DPhase = 0;
+  void handleFire2D(CRGB* leds, float steps);
+  // Effects: Noise 2D
+  uint16_t noiseZ = 0;
+  float noisePhase = 0;
+  void handleNoise2D(CRGB* leds, float steps);
+  // Effects: Rainbow 2D
+  void handleRainbow2D(CRGB* leds);
+  // Effects: Uploaded Programs
+  EffectProgram programs[MAX_EFFECT_PROGRAMS];
+#if PRINT_VM_TIMING
+  unsigned long programRenderTime = 0;
+  uint16_t programFrames = 0;
+  uint32_t programTimer = 0;
+#endif
+  int findProgram(String name);
+  bool checkProgram(const EffectProgram& program);
+  void handleProgram(int slot, CRGB* leds, unsigned long startTime);
 
  public:
   Light();
   void init(int numLeds, char* stripType, char* colorOrder, int dataPin,
-            int clockPin, byte maxBrightness);
+            int clockPin, byte maxBrightness, char* driverType,
+            int* outputLengths, int numOutputs);
   void loop();
   void identify();
   void turnOn();
@@ -137,10 +289,23 @@ class Light {
   void setBrightness(byte brightness);
   void setColor(CRGB color);
   void setEffect(String effect);
-  void setSpeed(byte speed);
+  void setSpeed(float speed);
+  void setCrossfadeTime(unsigned long crossfadeTime);
+  void setColorCorrection(float gamma, CRGB whitePoint);
+  bool setStream(char* multicastGroup, int sliceOffset, int sliceLength,
+                 int canvasLength);
+  bool setMatrix(int width, int height, bool serpentine, int rotation,
+                 char* origin);
+  void setPlaylist(PlaylistEntry* entries, byte numEntries);
+  void stopPlaylist();
+  void onStateChange(void (*callback)());
+  void onShow(void (*callback)());
+  bool isTransitioning();
   LightState getState();
   unsigned int getNumEffects();
   String* getEffectList();
+  void loadPrograms();
+  bool addProgram(const uint8_t* data, unsigned int length);
 };
 
 #endif
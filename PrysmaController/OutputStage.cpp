@@ -0,0 +1,103 @@
+#include "OutputStage.h"
+#include <Arduino.h>  // Enables use of Arduino specific functions and types
+#include <FastLED.h>
+#include "PrysmaLog.h"
+
+void OutputStage::setGamma(float gamma) {
+  if (gamma <= 0) {
+    LOG_WARNING("Invalid gamma %.2f, using %.2f", gamma, DEFAULT_GAMMA);
+    gamma = DEFAULT_GAMMA;
+  }
+  if (gamma != this->gamma) {
+    this->gamma = gamma;
+    this->curvesChanged = true;
+  }
+}
+
+void OutputStage::setWhitePoint(CRGB whitePoint) {
+  if (whitePoint != this->whitePoint) {
+    this->whitePoint = whitePoint;
+    this->curvesChanged = true;
+  }
+}
+
+bool OutputStage::setColorOrder(const char* colorOrder) {
+  // Every order is a permutation of R, G and B. Both the search and the index
+  // have to use the same string
+  static const char CHANNELS[] = "RGB";
+  byte order[3];
+  for (int i = 0; i < 3; i++) {
+    const char* channel = strchr(CHANNELS, colorOrder[i]);
+    if (colorOrder[i] == '\0' || channel == NULL) {
+      LOG_ERROR("Invalid color order %s", colorOrder);
+      return false;
+    }
+    order[i] = channel - CHANNELS;
+  }
+  if (order[0] == order[1] || order[0] == order[2] || order[1] == order[2]) {
+    LOG_ERROR("Invalid color order %s", colorOrder);
+    return false;
+  }
+  memcpy(this->order, order, sizeof(order));
+  this->tablesChanged = true;
+  return true;
+}
+
+void OutputStage::setBrightness(byte brightness) {
+  if (brightness != this->brightness) {
+    this->brightness = brightness;
+    this->tablesChanged = true;
+  }
+}
+
+void OutputStage::apply(const CRGB* in, CRGB* out, int numLeds) {
+  if (this->curvesChanged) {
+    buildCurves();
+  }
+  if (this->tablesChanged) {
+    buildTables();
+  }
+
+  const uint8_t* table0 = this->tables[0];
+  const uint8_t* table1 = this->tables[1];
+  const uint8_t* table2 = this->tables[2];
+  byte order0 = this->order[0];
+  byte order1 = this->order[1];
+  byte order2 = this->order[2];
+  for (int i = 0; i < numLeds; i++) {
+    // Read the whole pixel first so this works in place
+    const uint8_t* pixel = in[i].raw;
+    uint8_t c0 = table0[pixel[order0]];
+    uint8_t c1 = table1[pixel[order1]];
+    uint8_t c2 = table2[pixel[order2]];
+    out[i].raw[0] = c0;
+    out[i].raw[1] = c1;
+    out[i].raw[2] = c2;
+  }
+}
+
+void OutputStage::buildCurves() {
+  // The only floating point math, and only when gamma or white point change
+  for (int channel = 0; channel < 3; channel++) {
+    float scale = 65535.0 * this->whitePoint.raw[channel] / 255;
+    for (int value = 0; value < 256; value++) {
+      this->curves[channel][value] =
+          pow(value / 255.0, this->gamma) * scale + 0.5;
+    }
+  }
+  this->curvesChanged = false;
+  this->tablesChanged = true;
+}
+
+void OutputStage::buildTables() {
+  // Brightness changes every step of a transition, so keep this to integer
+  // math
+  uint32_t scale = this->brightness + 1;
+  for (int position = 0; position < 3; position++) {
+    const uint16_t* curve = this->curves[this->order[position]];
+    for (int value = 0; value < 256; value++) {
+      this->tables[position][value] = (curve[value] * scale) >> 16;
+    }
+  }
+  this->tablesChanged = false;
+}
@@ -0,0 +1,45 @@
+/*
+  OutputStage.h - Library for color correcting frames on their way to the LED
+  strip
+*/
+#ifndef OutputStage_h
+#define OutputStage_h
+
+#include <Arduino.h>
+#define FASTLED_INTERNAL  // Disable pragma messages
+#include <FastLED.h>
+
+#define DEFAULT_GAMMA 1.0
+
+/*
+  Gamma, white point, brightness and color order are folded into one lookup
+  table per output channel, so a frame costs one lookup per channel no matter
+  how many corrections are turned on. The tables are only rebuilt when one of
+  the settings changes.
+*/
+class OutputStage {
+ public:
+  void setGamma(float gamma);
+  void setWhitePoint(CRGB whitePoint);
+  bool setColorOrder(const char* colorOrder);
+  void setBrightness(byte brightness);
+  // Correct a frame. in and out can be the same buffer
+  void apply(const CRGB* in, CRGB* out, int numLeds);
+
+ private:
+  float gamma = DEFAULT_GAMMA;
+  CRGB whitePoint = CRGB(255, 255, 255);
+  byte brightness = 255;
+  byte order[3] = {0, 1, 2};  // Input channel sent in each output position
+  // Gamma and white point for each input channel. Kept at 16 bits so dimming
+  // afterwards doesn't flatten the low end of the curve
+  uint16_t curves[3][256];
+  // Final lookup for each output position
+  uint8_t tables[3][256];
+  bool curvesChanged = true;
+  bool tablesChanged = true;
+  void buildCurves();
+  void buildTables();
+};
+
+#endif
@@ -0,0 +1,22 @@
+#include "PrysmaClock.h"
+#include <Arduino.h>  // Enables use of Arduino specific functions and types
+#include <sys/time.h>
+#include <time.h>
+#include "PrysmaLog.h"
+
+// Anything before this is the clock counting up from 0 at boot
+#define CLOCK_VALID_AFTER 1500000000UL  // July 2017
+
+void setupClock(const char* ntpServer) {
+  // The SDK keeps the clock in sync in the background from here on
+  configTime(0, 0, ntpServer);
+  LOG_INFO("NTP Server - %s", ntpServer);
+}
+
+bool isClockSet() { return time(NULL) > CLOCK_VALID_AFTER; }
+
+uint64_t getEpochMillis() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return (uint64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+}
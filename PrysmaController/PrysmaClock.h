@@ -0,0 +1,18 @@
+/*
+  PrysmaClock.h - Library for keeping Prysma-Controller's wall clock in sync
+  over NTP so lights can act at the same moment
+*/
+#ifndef PrysmaClock_h
+#define PrysmaClock_h
+
+#include <Arduino.h>
+
+void setupClock(const char* ntpServer);
+
+// False until the first NTP response arrives
+bool isClockSet();
+
+// Unix time in ms
+uint64_t getEpochMillis();
+
+#endif
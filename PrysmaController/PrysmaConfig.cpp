@@ -1,67 +1,145 @@
 #include "PrysmaConfig.h"
 #include <ArduinoJson.h>
 #include "FS.h"
+#include "PrysmaLog.h"
 
 Config config;
 
 void setupConfig() {
   // Initialize SPIFFS
   if (!SPIFFS.begin()) {
-    Serial.println("[ERROR]: An Error has occurred while mounting SPIFFS");
+    LOG_ERROR("An Error has occurred while mounting SPIFFS");
     return;
   }
 
   // Open config.json for reading
   File configFile = SPIFFS.open("/config.json", "r");
   if (!configFile) {
-    Serial.println("[ERROR]: Failed to open config.json for reading");
+    LOG_ERROR("Failed to open config.json for reading");
     return;
   }
 
-  // Deserialize the JSON
-  StaticJsonDocument<512> doc;
+  // Deserialize the JSON. Keys are copied out of the file too, so leave room
+  // for every config field
+  StaticJsonDocument<1024> doc;
   // Deserialize the JSON document
   DeserializationError error = deserializeJson(doc, configFile);
   if (error) {
-    Serial.println(
-        F("[ERROR]: Failed to read file, using default configuration"));
+    LOG_ERROR("Failed to read file, using default configuration");
   }
 
   // Never use a JsonDocument to store the configuration!
   // A JsonDocument is *not* a permanent storage; it's only a temporary storage
   // used during the serialization phase. See:
   // https://arduinojson.org/v6/faq/why-must-i-create-a-separate-config-object/
-  config.numLeds = doc["numLeds"] | 60;
+  // Parallel outputs split the leds between them, so numLeds is optional
+  int outputTotal = 0;
+  config.numOutputs = 0;
+  for (JsonVariant length : doc["outputs"].as<JsonArray>()) {
+    if (config.numOutputs >= 4) {
+      LOG_WARNING("Too many outputs, ignoring the rest");
+      break;
+    }
+    config.outputLengths[config.numOutputs++] = length.as<int>();
+    outputTotal += length.as<int>();
+  }
+  config.numLeds = doc["numLeds"] | (outputTotal > 0 ? outputTotal : 60);
   config.dataPin = doc["dataPin"] | 5;
   config.clockPin = doc["clockPin"] | -1;
   config.maxBrightness = doc["maxBrightness"] | 255;
+  config.crossfadeTime = doc["crossfadeTime"] | 1000;
+  config.matrixWidth = doc["matrix"]["width"] | 0;
+  config.matrixHeight = doc["matrix"]["height"] | 0;
+  config.matrixRotation = doc["matrix"]["rotation"] | 0;
+  config.matrixSerpentine = doc["matrix"]["serpentine"] | true;
+  config.sliceOffset = doc["sliceOffset"] | 0;
+  config.sliceLength = doc["sliceLength"] | config.numLeds;
+  config.canvasLength =
+      doc["canvasLength"] | config.sliceOffset + config.sliceLength;
+  config.gamma = doc["gamma"] | 1.0;
+  config.whitePoint[0] = doc["whitePoint"]["r"] | 255;
+  config.whitePoint[1] = doc["whitePoint"]["g"] | 255;
+  config.whitePoint[2] = doc["whitePoint"]["b"] | 255;
+  config.webSocket = doc["webSocket"] | false;
   // We need to use strlcpy to copy the config info from doc instead of just having a pointer to it
   // If we dont, the config info will be lost partway through running the program causing strange behavior
-  strlcpy(config.stripType,                    // <- destination
-          doc["stripType"] | "WS2812B",        // <- source
-          sizeof(config.stripType));           // <- destination's capacity
-  strlcpy(config.colorOrder,                   // <- destination
-          doc["colorOrder"] | "GRB",           // <- source
-          sizeof(config.colorOrder));          // <- destination's capacity
-  strlcpy(config.mqttUsername,                 // <- destination
-          doc["mqttUsername"] | "",            // <- source
-          sizeof(config.mqttUsername));        // <- destination's capacity
-  strlcpy(config.mqttPassword,                 // <- destination
-          doc["mqttPassword"] | "",            // <- source
-          sizeof(config.mqttPassword));        // <- destination's capacity
-  strlcpy(config.controllerHardware,           // <- destination
-          "ESP8266",                           // <- source
-          sizeof(config.controllerHardware));  // <- destination's capacity
+  strlcpy(config.stripType,                     // <- destination
+          doc["stripType"] | "WS2812B",         // <- source
+          sizeof(config.stripType));            // <- destination's capacity
+  strlcpy(config.colorOrder,                    // <- destination
+          doc["colorOrder"] | "GRB",            // <- source
+          sizeof(config.colorOrder));           // <- destination's capacity
+  strlcpy(config.ledDriver,                     // <- destination
+          doc["ledDriver"] | "fastled",         // <- source
+          sizeof(config.ledDriver));            // <- destination's capacity
+  strlcpy(config.payloadFormat,                 // <- destination
+          doc["payloadFormat"] | "json",        // <- source
+          sizeof(config.payloadFormat));        // <- destination's capacity
+  strlcpy(config.matrixOrigin,                  // <- destination
+          doc["matrix"]["origin"] | "topLeft",  // <- source
+          sizeof(config.matrixOrigin));         // <- destination's capacity
+  strlcpy(config.multicastGroup,                // <- destination
+          doc["multicastGroup"] | "",           // <- source
+          sizeof(config.multicastGroup));       // <- destination's capacity
+  config.numGroups = 0;
+  for (JsonVariant group : doc["groups"].as<JsonArray>()) {
+    if (config.numGroups >= 4) {
+      LOG_WARNING("Too many groups, ignoring the rest");
+      break;
+    }
+    strlcpy(config.groups[config.numGroups++],  // <- destination
+            group | "",                         // <- source
+            sizeof(config.groups[0]));          // <- destination's capacity
+  }
+  strlcpy(config.ntpServer,                     // <- destination
+          doc["ntpServer"] | "pool.ntp.org",    // <- source
+          sizeof(config.ntpServer));            // <- destination's capacity
+  strlcpy(config.mqttUsername,                  // <- destination
+          doc["mqttUsername"] | "",             // <- source
+          sizeof(config.mqttUsername));         // <- destination's capacity
+  strlcpy(config.mqttPassword,                  // <- destination
+          doc["mqttPassword"] | "",             // <- source
+          sizeof(config.mqttPassword));         // <- destination's capacity
+  strlcpy(config.webSocketPassword,             // <- destination
+          doc["webSocketPassword"] | "",        // <- source
+          sizeof(config.webSocketPassword));    // <- destination's capacity
+  strlcpy(config.controllerHardware,            // <- destination
+          "ESP8266",                            // <- source
+          sizeof(config.controllerHardware));   // <- destination's capacity
 
   configFile.close();
 
-  Serial.printf("[INFO]: numLeds - %i\n", config.numLeds);
-  Serial.printf("[INFO]: dataPin - %i\n", config.dataPin);
-  Serial.printf("[INFO]: clockPin - %i\n", config.clockPin);
-  Serial.printf("[INFO]: maxBrightness - %i\n", config.maxBrightness);
-  Serial.printf("[INFO]: stripType - %s\n", config.stripType);
-  Serial.printf("[INFO]: colorOrder - %s\n", config.colorOrder);
-  Serial.printf("[INFO]: controllerHardware - %s\n", config.controllerHardware);
-  Serial.printf("[INFO]: mqttUsername - %s\n", config.mqttUsername);
-  Serial.printf("[INFO]: mqttPassword - %s\n", config.mqttPassword);
+  LOG_INFO("numLeds - %i", config.numLeds);
+  LOG_INFO("dataPin - %i", config.dataPin);
+  for (int i = 0; i < config.numOutputs; i++) {
+    LOG_INFO("output %i - %i leds", i, config.outputLengths[i]);
+  }
+  LOG_INFO("clockPin - %i", config.clockPin);
+  LOG_INFO("maxBrightness - %i", config.maxBrightness);
+  LOG_INFO("crossfadeTime - %i", config.crossfadeTime);
+  LOG_INFO("matrix - %ix%i, %s, rotation %i, origin %s", config.matrixWidth,
+           config.matrixHeight,
+           config.matrixSerpentine ? "serpentine" : "progressive",
+           config.matrixRotation, config.matrixOrigin);
+  LOG_INFO("multicastGroup - %s", config.multicastGroup);
+  LOG_INFO("slice - %i leds from %i of %i", config.sliceLength,
+           config.sliceOffset, config.canvasLength);
+  for (int i = 0; i < config.numGroups; i++) {
+    LOG_INFO("group - %s", config.groups[i]);
+  }
+  LOG_INFO("ntpServer - %s", config.ntpServer);
+  LOG_INFO("gamma - %.2f", config.gamma);
+  LOG_INFO("whitePoint - %i, %i, %i", config.whitePoint[0],
+           config.whitePoint[1], config.whitePoint[2]);
+  LOG_INFO("stripType - %s", config.stripType);
+  LOG_INFO("colorOrder - %s", config.colorOrder);
+  LOG_INFO("ledDriver - %s", config.ledDriver);
+  LOG_INFO("payloadFormat - %s", config.payloadFormat);
+  LOG_INFO("controllerHardware - %s", config.controllerHardware);
+  LOG_INFO("mqttUsername - %s", config.mqttUsername);
+  LOG_INFO("mqttPassword - %s", config.mqttPassword);
+  LOG_INFO("webSocket - %s", config.webSocket ? "on" : "off");
+  // Only say whether there is one, the log can be published
+  LOG_INFO("webSocketPassword - %s",
+           config.webSocketPassword[0] != '\0' ? "set" : "not set");
 }
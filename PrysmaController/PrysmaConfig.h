@@ -12,14 +12,35 @@ void setupConfig();
 
 struct Config {
   int numLeds;
+  int outputLengths[4];  // Leds on each parallel output, in order
+  int numOutputs;        // 0 for a single strip on dataPin
   int dataPin;
   int clockPin;
   int maxBrightness;
+  int crossfadeTime;
+  int matrixWidth;  // 0 when the leds are a strip
+  int matrixHeight;
+  int matrixRotation;
+  bool matrixSerpentine;
+  int sliceOffset;  // First led of the stream canvas this light shows
+  int sliceLength;
+  int canvasLength;  // Leds in every stream frame, at least the slice's end
+  float gamma;
+  int whitePoint[3];  // Full brightness of each of r, g and b (0-255)
   char stripType[16];
   char colorOrder[4];
+  char ledDriver[16];
+  char payloadFormat[8];
+  char matrixOrigin[12];
+  char multicastGroup[16];  // Empty for unicast streams only
+  char groups[4][16];       // Names of the command groups this light is in
+  int numGroups;
+  char ntpServer[32];
   char controllerHardware[16];
   char mqttUsername[50];
   char mqttPassword[50];
+  bool webSocket;  // Off unless turned on, see webSocketPassword
+  char webSocketPassword[50];
 };
 
 extern Config config;
@@ -11,13 +11,35 @@
 #include <ESP8266WiFi.h>
 
 #include "Light.h";
+#include "PrysmaLog.h"
+#include "PrysmaClock.h"
 #include "PrysmaConfig.h"
 #include "PrysmaMQTT.h";
 #include "PrysmaOTA.h";
+#include "PrysmaTelemetry.h"
+#include "PrysmaTrace.h"
+#include "PrysmaWebSocket.h"
 #include "PrysmaWifi.h";
 
 #define DEBUG true
 #define VERSION "2.0.0"
+// Toggles the payload benchmark on boot (1 = print JSON vs MessagePack timings
+// over serial, 0 = disable)
+#define BENCHMARK_PAYLOADS 0
+// Toggles publishing the log (1 = publish every log line to the log topic,
+// 0 = serial only)
+#define PUBLISH_LOG 0
+// Spreads out the state publishes of lights that got the same group command
+#define STATE_PUBLISH_JITTER 500  // In ms
+// Furthest ahead a command can be scheduled with applyAt
+#define MAX_APPLY_DELAY 60000  // In ms
+// Every field of a command, with a full playlist of entries that each have an
+// effect, duration and color. Strings point into the payload, so only the
+// slots count
+#define COMMAND_DOC_SIZE                                             \
+  (JSON_OBJECT_SIZE(10) + JSON_OBJECT_SIZE(3) +                      \
+   JSON_ARRAY_SIZE(MAX_PLAYLIST_ENTRIES) +                           \
+   MAX_PLAYLIST_ENTRIES * (JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(3)))
 
 //*******************************************************
 // Global Variables
@@ -27,8 +49,24 @@ char PRYSMA_ID[19];
 char connectedMessage[50];
 char disconnectedMessage[50];
 
-char mutationId[37];  // uuidv4 (36 characters + 1)
-bool mutationIdWasChanged = false;
+// Ids of the commands applied since the last state publish, oldest first.
+// Every one of them is answered, so a full list publishes before the next
+// command
+#define MAX_MUTATION_IDS 4
+char mutationIds[MAX_MUTATION_IDS][37];  // uuidv4 (36 characters + 1)
+byte numMutationIds = 0;
+
+// State publishes are held back a little so a burst of commands only
+// publishes once
+bool statePending = false;
+unsigned long statePublishTime = 0;
+
+// A command waiting for its applyAt time, re-encoded as MessagePack
+byte scheduledCommand[512];
+size_t scheduledLength = 0;
+bool commandScheduled = false;
+unsigned long scheduledTime = 0;
+unsigned long scheduledStateDelay = 0;
 
 Light light;
 
@@ -45,15 +83,36 @@ void setupConnectedMessages() {
   serializeJson(doc, disconnectedMessage);
 }
 
-// Send the state of the light via MQTT
-void sendState() {
-  StaticJsonDocument<512> doc;
+// Publish a message as JSON and/or MessagePack depending on
+// config.payloadFormat
+void publishDocument(JsonDocument &doc, const char *jsonTopic,
+                     const char *msgpackTopic, boolean retained) {
+  if (strcmp(config.payloadFormat, "msgpack") != 0) {
+    char message[512];
+    serializeJson(doc, message);
+    mqttClient.publish(jsonTopic, message, retained);
+    LOG_DEBUG("Published %s to <%s>", message, jsonTopic);
+  }
+  if (strcmp(config.payloadFormat, "json") != 0) {
+    char message[512];
+    size_t length = serializeMsgPack(doc, message, sizeof(message));
+    mqttClient.publish(msgpackTopic, (const uint8_t *)message, length,
+                       retained);
+    LOG_DEBUG("Published %u bytes to <%s>", length, msgpackTopic);
+  }
+}
 
-  // populate payload with mutationId if one was sent
-  if (mutationIdWasChanged) {
-    Serial.printf("Mutation Id: %s\n", mutationId);
-    doc["mutationId"] = mutationId;
-    bool mutationIdWasChanged = false;
+void buildState(JsonDocument &doc) {
+  // populate payload with the mutationIds if any were sent. mutationId is the
+  // latest one
+  if (numMutationIds > 0) {
+    const char *latest = mutationIds[numMutationIds - 1];
+    LOG_DEBUG("Mutation Id: %s", latest);
+    doc["mutationId"] = latest;
+    JsonArray ids = doc.createNestedArray("mutationIds");
+    for (byte i = 0; i < numMutationIds; i++) {
+      ids.add((const char *)mutationIds[i]);
+    }
   }
 
   doc["id"] = PRYSMA_ID;
@@ -67,31 +126,65 @@ void sendState() {
   color["b"] = state.color.b;
   doc["effect"] = state.effect;
   doc["speed"] = state.speed;
+  doc["playlist"] = state.playlist;
+}
 
-  char stateMessage[512];
-  serializeJson(doc, stateMessage);
+// Send the state of the light via MQTT and to any WebSocket clients
+void sendState() {
+  StaticJsonDocument<512> doc;
+  buildState(doc);
+  publishDocument(doc, STATE_TOPIC, STATE_MSGPACK_TOPIC, true);
+  sendWebSocketDocument(doc, -1);
+  numMutationIds = 0;
+}
 
-  mqttClient.publish(STATE_TOPIC, stateMessage, true);
-  Serial.printf("[INFO]: Published %s to <%s>\n", stateMessage, STATE_TOPIC);
+// Remember a command's id for the next state publish
+void addMutationId(const char *id) {
+  if (numMutationIds > 0 &&
+      strcmp(id, mutationIds[numMutationIds - 1]) == 0) {
+    return;
+  }
+  if (numMutationIds >= MAX_MUTATION_IDS) {
+    LOG_WARNING("No room for mutationId %s", id);
+    return;
+  }
+  strlcpy(mutationIds[numMutationIds++],  // <- destination
+          id,                             // <- source
+          sizeof(mutationIds[0]));        // <- destination's capacity
 }
 
-// Send the list of supported effects via MQTT
-void sendEffectList() {
-  Serial.println("Send Effect List");
-  StaticJsonDocument<512> doc;
+// Send the state in delay ms, or sooner if it was already due
+void requestState(unsigned long delay) {
+  unsigned long publishTime = millis() + delay;
+  if (!statePending || (long)(publishTime - statePublishTime) < 0) {
+    statePublishTime = publishTime;
+  }
+  statePending = true;
+}
+
+void handleStatePublish() {
+  if (statePending && (long)(millis() - statePublishTime) >= 0) {
+    statePending = false;
+    sendState();
+  }
+}
+
+void buildEffectList(JsonDocument &doc) {
   doc["id"] = PRYSMA_ID;
   JsonArray effectList = doc.createNestedArray("effectList");
   String *effects = light.getEffectList();
   for (int i = 0; i < light.getNumEffects(); i++) {
     effectList.add(effects[i]);
   }
+}
 
-  char effectListMessage[512];
-  serializeJson(doc, effectListMessage);
-
-  mqttClient.publish(EFFECT_LIST_TOPIC, effectListMessage, true);
-  Serial.printf("[INFO]: Published %s to <%s>\n", effectListMessage,
-                EFFECT_LIST_TOPIC);
+// Send the list of supported effects via MQTT and to any WebSocket clients
+void sendEffectList() {
+  LOG_DEBUG("Send Effect List");
+  StaticJsonDocument<512> doc;
+  buildEffectList(doc);
+  publishDocument(doc, EFFECT_LIST_TOPIC, EFFECT_LIST_MSGPACK_TOPIC, true);
+  sendWebSocketDocument(doc, -1);
 }
 
 // Send the config of the light via MQTT
@@ -106,51 +199,175 @@ void sendConfig(boolean discoveryResponse = false) {
   doc["macAddress"] = WiFi.macAddress();
   doc["numLeds"] = config.numLeds;
   doc["udpPort"] = 7778;
-
-  char configMessage[512];
-  serializeJson(doc, configMessage);
+  // Lets the visualizer lay out one multicast canvas across many lights
+  doc["multicastGroup"] = config.multicastGroup;
+  doc["sliceOffset"] = config.sliceOffset;
+  doc["sliceLength"] = config.sliceLength;
+  doc["canvasLength"] = config.canvasLength;
 
   if (discoveryResponse) {
     // Send a one time message to the discovery response (dont retain the
     // message)
-    mqttClient.publish(DISCOVERY_RESPONSE_TOPIC, configMessage);
-    Serial.printf("[INFO]: Published %s to <%s>\n", configMessage,
-                  DISCOVERY_RESPONSE_TOPIC);
+    publishDocument(doc, DISCOVERY_RESPONSE_TOPIC,
+                    DISCOVERY_RESPONSE_MSGPACK_TOPIC, false);
   } else {
-    mqttClient.publish(CONFIG_TOPIC, configMessage, true);
-    Serial.printf("[INFO]: Published %s to <%s>\n", configMessage,
-                  CONFIG_TOPIC);
+    publishDocument(doc, CONFIG_TOPIC, CONFIG_MSGPACK_TOPIC, true);
   }
 }
 
+// Add the percentiles of a latency summary to a message
+void addLatency(JsonObject latency, LatencySummary summary) {
+  latency["p50"] = summary.p50;
+  latency["p95"] = summary.p95;
+  latency["max"] = summary.max;
+  latency["count"] = summary.count;
+}
+
+// Send heap and stack usage and command latencies via MQTT
+void sendTelemetry() {
+  StaticJsonDocument<512> doc;
+  doc["id"] = PRYSMA_ID;
+  doc["uptime"] = millis() / 1000;
+
+  MemoryStats stats = getMemoryStats();
+  doc["freeHeap"] = stats.freeHeap;
+  doc["maxFreeBlock"] = stats.maxFreeBlock;
+  doc["fragmentation"] = stats.fragmentation;
+  doc["freeStack"] = stats.freeStack;
+
+  // Worst values since boot
+  MemoryStats worst = getWorstMemoryStats();
+  JsonObject lowest = doc.createNestedObject("min");
+  lowest["freeHeap"] = worst.freeHeap;
+  lowest["maxFreeBlock"] = worst.maxFreeBlock;
+  lowest["freeStack"] = worst.freeStack;
+  doc["maxFragmentation"] = worst.fragmentation;
+  doc["droppedLogs"] = getDroppedLogCount();
+
+  // Recent commands, in us from receipt
+  JsonObject latency = doc.createNestedObject("latency");
+  addLatency(latency.createNestedObject("show"), getShowLatency());
+  addLatency(latency.createNestedObject("transition"), getTransitionLatency());
+
+  publishDocument(doc, TELEMETRY_TOPIC, TELEMETRY_MSGPACK_TOPIC, false);
+}
+
+// Send how long a command took to show up on the leds via MQTT
+void sendTrace(const CommandTrace &trace) {
+  StaticJsonDocument<256> doc;
+  doc["id"] = PRYSMA_ID;
+  doc["mutationId"] = trace.mutationId;
+  doc["transitionStart"] = trace.transitionStart;
+  doc["firstShow"] = trace.firstShow;
+  doc["transitionEnd"] = trace.transitionEnd;
+  publishDocument(doc, TRACE_TOPIC, TRACE_MSGPACK_TOPIC, false);
+}
+
+#if PUBLISH_LOG
+// Publish a line of the log via MQTT. Can't log anything itself, or every
+// line would log another one
+void publishLogLine(const char *line) {
+  if (mqttClient.connected()) {
+    mqttClient.publish(LOG_TOPIC, line);
+  }
+}
+#endif
+
 // Respond to a discovery query with the config information of the light
 void sendDiscoveryResponse() { sendConfig(true); }
 
-// Deal with a message on the command topic
-void handleCommand(byte *payload) {
-  Serial.println("[INFO]: Handling Command Message");
+// Deal with an uploaded effect program
+void handleEffectUpload(byte *payload, unsigned int length) {
+  LOG_INFO("Handling Effect Upload Message");
+  if (!light.addProgram(payload, length)) {
+    LOG_ERROR("Rejected effect program");
+    return;
+  }
+  sendEffectList();
+  sendState();
+}
 
-  // Parse JSON
-  StaticJsonDocument<512> doc;
-  DeserializationError error = deserializeJson(doc, payload);
+// Hold a command until its applyAt time so a whole group changes at once.
+// Returns false if it should be applied now instead
+bool scheduleCommand(JsonDocument &doc, unsigned long stateDelay) {
+  if (!isClockSet()) {
+    LOG_WARNING("Clock isn't set yet, ignoring applyAt");
+    return false;
+  }
+  uint64_t applyAt = (uint64_t)doc["applyAt"].as<unsigned long>() * 1000 +
+                     (doc["applyAtMs"] | 0);
+  int64_t delay = applyAt - getEpochMillis();
+  if (delay <= 0) {
+    LOG_DEBUG("applyAt was %lu ms ago", (unsigned long)-delay);
+    return false;
+  }
+  if (delay > MAX_APPLY_DELAY) {
+    LOG_WARNING("applyAt is more than %u ms away, ignoring it",
+                MAX_APPLY_DELAY);
+    return false;
+  }
+
+  doc.remove("applyAt");
+  doc.remove("applyAtMs");
+  if (measureMsgPack(doc) > sizeof(scheduledCommand)) {
+    LOG_WARNING("Command is too big to schedule, ignoring applyAt");
+    return false;
+  }
+  if (commandScheduled) {
+    LOG_WARNING("Replacing the scheduled command");
+  }
+  scheduledLength =
+      serializeMsgPack(doc, scheduledCommand, sizeof(scheduledCommand));
+  scheduledTime = millis() + (unsigned long)delay;
+  scheduledStateDelay = stateDelay;
+  commandScheduled = true;
+  LOG_DEBUG("Applying command in %lu ms", (unsigned long)delay);
+  return true;
+}
+
+// Deal with a message on the command topic. The state is published
+// stateDelay ms later
+void handleCommand(byte *payload, unsigned int length, bool msgpack,
+                   unsigned long stateDelay) {
+  // Every command comes through here, scheduled ones when they're applied
+  traceCommandReceived();
+  LOG_DEBUG("Handling Command Message");
+
+  // Make room for this command's id. The state is sent now rather than once
+  // doc is filled in, so the two documents are never in use at once
+  if (numMutationIds >= MAX_MUTATION_IDS) {
+    sendState();
+  }
+
+  // Parse JSON or MessagePack (with room for a full playlist). Since payload
+  // isn't const, strings in doc point straight into it instead of being
+  // copied. It's too big for the 4KB stack, so it's static
+  static StaticJsonDocument<COMMAND_DOC_SIZE> doc;
+  DeserializationError error = msgpack
+                                   ? deserializeMsgPack(doc, payload, length)
+                                   : deserializeJson(doc, payload, length);
   if (error) {
-    Serial.println("[ERROR]: Failed to parse config message JSON");
+    LOG_ERROR("Failed to parse command message - %s", error.c_str());
+    return;
+  }
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+  char message[LOG_LINE_LENGTH];
+  serializeJson(doc, message, sizeof(message));
+  LOG_DEBUG("%s", message);
+#endif
+
+  if (doc.containsKey("applyAt") && scheduleCommand(doc, stateDelay)) {
     return;
   }
-  // Pretty print JSON
-  serializeJsonPretty(doc, Serial);
-  Serial.println();  // Add a linebreak to the end
 
-  // Update the next sendState response with the mutationId
-  if (doc.containsKey("mutationId") &&
-      strcmp(doc["mutationId"], mutationId) != 0) {
-    strlcpy(mutationId,           // <- destination
-            doc["mutationId"],    // <- source
-            sizeof(mutationId));  // <- destination's capacity
-    mutationIdWasChanged = true;
+  // Add the mutationId to the next sendState response
+  const char *commandMutationId = doc["mutationId"];
+  if (commandMutationId != NULL) {
+    addMutationId(commandMutationId);
   }
 
   // Handle the actual commands
+  traceTransitionStart(doc["mutationId"] | "");
   if (doc.containsKey("on")) {
     bool on = doc["on"];
     if (on) {
@@ -178,39 +395,90 @@ void handleCommand(byte *payload) {
   }
 
   if (doc.containsKey("speed")) {
-    byte speed = doc["speed"];
+    float speed = doc["speed"];
     light.setSpeed(speed);
   }
 
-  sendState();
+  if (doc.containsKey("playlist")) {
+    PlaylistEntry playlist[MAX_PLAYLIST_ENTRIES];
+    byte numEntries = 0;
+    for (JsonObject entry : doc["playlist"].as<JsonArray>()) {
+      if (numEntries >= MAX_PLAYLIST_ENTRIES) {
+        LOG_WARNING("Playlist is too long, ignoring the rest");
+        break;
+      }
+      playlist[numEntries].effect = entry["effect"] | NO_EFFECT;
+      playlist[numEntries].color = CRGB(entry["color"]["r"] | 255,
+                                        entry["color"]["g"] | 255,
+                                        entry["color"]["b"] | 255);
+      // Negative durations would wrap, Light clamps the short ones
+      long duration = entry["duration"] | 60L;
+      playlist[numEntries].duration =
+          constrain(duration, 0L, MAX_PLAYLIST_DURATION) * 1000UL;
+      numEntries++;
+    }
+    light.setPlaylist(playlist, numEntries);
+  }
+
+  requestState(stateDelay);
+}
+
+void handleScheduledCommand() {
+  if (commandScheduled && (long)(millis() - scheduledTime) >= 0) {
+    commandScheduled = false;
+    handleCommand(scheduledCommand, scheduledLength, true,
+                  scheduledStateDelay);
+  }
 }
 
 // Deal with a discovery query
 void handleDiscovery() {
-  Serial.println("[INFO]: Handling Discovery Message");
+  LOG_INFO("Handling Discovery Message");
   sendDiscoveryResponse();
 }
 
 // Deal with an identify command
 void handleIdentify() {
-  Serial.println("[INFO]: Handling Identify Message");
+  LOG_INFO("Handling Identify Message");
   light.identify();
 }
 
+// Deal with a message on a group command topic. Every light in the group gets
+// it at once, so their state publishes are spread out. Returns false if the
+// topic isn't a group this light is in
+bool handleGroupCommand(char *topic, byte *payload, unsigned int length) {
+  for (int i = 0; i < numGroupTopics; i++) {
+    if (strcmp(topic, GROUP_COMMAND_TOPICS[i]) == 0) {
+      handleCommand(payload, length, false, random(STATE_PUBLISH_JITTER));
+      return true;
+    } else if (strcmp(topic, GROUP_COMMAND_MSGPACK_TOPICS[i]) == 0) {
+      handleCommand(payload, length, true, random(STATE_PUBLISH_JITTER));
+      return true;
+    }
+  }
+  return false;
+}
+
 void handleMessage(char *topic, byte *payload, unsigned int length) {
-  Serial.printf("[INFO]: Message arrived on <%s>\n", topic);
+  LOG_DEBUG("Message arrived on <%s>", topic);
 
   // Route the message to the appropriate handler
   if (strcmp(topic, COMMAND_TOPIC) == 0) {
-    handleCommand(payload);
+    handleCommand(payload, length, false, 0);
+  } else if (strcmp(topic, COMMAND_MSGPACK_TOPIC) == 0) {
+    handleCommand(payload, length, true, 0);
+  } else if (handleGroupCommand(topic, payload, length)) {
+    return;
   } else if (strcmp(topic, DISCOVERY_TOPIC) == 0) {
     handleDiscovery();
   } else if (strcmp(topic, IDENTIFY_TOPIC) == 0) {
     handleIdentify();
+  } else if (strcmp(topic, EFFECT_UPLOAD_TOPIC) == 0) {
+    handleEffectUpload(payload, length);
   } else {
-    Serial.println(
-        "[WARNING]: Incoming message topic did not match any that we are "
-        "supposed to be subscribed to");
+    LOG_WARNING(
+        "Incoming message topic did not match any that we are supposed to be "
+        "subscribed to");
   }
 }
 
@@ -218,16 +486,25 @@ void handleMessage(char *topic, byte *payload, unsigned int length) {
 void handleConnect() {
   // Subscribe to all relevent topics
   mqttClient.subscribe(COMMAND_TOPIC);
-  Serial.printf("[INFO]: Subscribed to %s\n", COMMAND_TOPIC);
+  LOG_INFO("Subscribed to %s", COMMAND_TOPIC);
+  mqttClient.subscribe(COMMAND_MSGPACK_TOPIC);
+  LOG_INFO("Subscribed to %s", COMMAND_MSGPACK_TOPIC);
   mqttClient.subscribe(DISCOVERY_TOPIC);
-  Serial.printf("[INFO]: Subscribed to %s\n", DISCOVERY_TOPIC);
+  LOG_INFO("Subscribed to %s", DISCOVERY_TOPIC);
   mqttClient.subscribe(IDENTIFY_TOPIC);
-  Serial.printf("[INFO]: Subscribed to %s\n", IDENTIFY_TOPIC);
+  LOG_INFO("Subscribed to %s", IDENTIFY_TOPIC);
+  mqttClient.subscribe(EFFECT_UPLOAD_TOPIC);
+  LOG_INFO("Subscribed to %s", EFFECT_UPLOAD_TOPIC);
+  for (int i = 0; i < numGroupTopics; i++) {
+    mqttClient.subscribe(GROUP_COMMAND_TOPICS[i]);
+    LOG_INFO("Subscribed to %s", GROUP_COMMAND_TOPICS[i]);
+    mqttClient.subscribe(GROUP_COMMAND_MSGPACK_TOPICS[i]);
+    LOG_INFO("Subscribed to %s", GROUP_COMMAND_MSGPACK_TOPICS[i]);
+  }
 
   // Publish that we are connected;
   mqttClient.publish(CONNECTED_TOPIC, connectedMessage, true);
-  Serial.printf("[INFO]: Published %s to <%s>\n", connectedMessage,
-                CONNECTED_TOPIC);
+  LOG_INFO("Published %s to <%s>", connectedMessage, CONNECTED_TOPIC);
 
   // Publish all current light values over MQTT
   sendState();
@@ -235,6 +512,72 @@ void handleConnect() {
   sendConfig();
 }
 
+//*******************************************************
+// WebSocket Handlers
+//*******************************************************
+void handleWebSocketCommand(byte *payload, unsigned int length, bool msgpack) {
+  handleCommand(payload, length, msgpack, 0);
+}
+
+// Give a new WebSocket client the same retained messages an MQTT client gets
+void handleWebSocketConnect(uint8_t client) {
+  StaticJsonDocument<512> doc;
+  buildState(doc);
+  sendWebSocketDocument(doc, client);
+  doc.clear();
+  buildEffectList(doc);
+  sendWebSocketDocument(doc, client);
+}
+
+#if BENCHMARK_PAYLOADS
+// Compare encoding the state message as JSON and MessagePack
+void benchmarkPayloads() {
+  const int iterations = 100;
+  StaticJsonDocument<512> doc;
+  buildState(doc);
+
+  char json[512];
+  char msgpack[512];
+  size_t jsonLength = 0;
+  size_t msgpackLength = 0;
+
+  unsigned long start = micros();
+  for (int i = 0; i < iterations; i++) {
+    jsonLength = serializeJson(doc, json);
+  }
+  unsigned long jsonSerializeTime = (micros() - start) / iterations;
+
+  start = micros();
+  for (int i = 0; i < iterations; i++) {
+    msgpackLength = serializeMsgPack(doc, msgpack, sizeof(msgpack));
+  }
+  unsigned long msgpackSerializeTime = (micros() - start) / iterations;
+
+  // Parsing in place modifies the input, so each run parses a fresh copy the
+  // same way handleCommand parses the PubSubClient buffer
+  StaticJsonDocument<512> parsed;
+  char input[512];
+  start = micros();
+  for (int i = 0; i < iterations; i++) {
+    memcpy(input, json, jsonLength);
+    deserializeJson(parsed, input, jsonLength);
+  }
+  unsigned long jsonParseTime = (micros() - start) / iterations;
+
+  start = micros();
+  for (int i = 0; i < iterations; i++) {
+    memcpy(input, msgpack, msgpackLength);
+    deserializeMsgPack(parsed, input, msgpackLength);
+  }
+  unsigned long msgpackParseTime = (micros() - start) / iterations;
+
+  LOG_INFO("JSON - %u bytes, serialize %lu us, parse %lu us", jsonLength,
+           jsonSerializeTime, jsonParseTime);
+  LOG_INFO("MessagePack - %u bytes, serialize %lu us, parse %lu us",
+           msgpackLength, msgpackSerializeTime, msgpackParseTime);
+}
+#endif
+
 //*******************************************************
 // Main Functions
 //*******************************************************
@@ -252,7 +595,7 @@ void setup() {
   WiFi.macAddress(mac);
   snprintf(PRYSMA_ID, sizeof(PRYSMA_ID), "Prysma-%02X%02X%02X%02X%02X%02X",
            mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-  Serial.printf("[INFO]: %s Booting\n", PRYSMA_ID);
+  LOG_INFO("%s Booting", PRYSMA_ID);
 
   // Connect to WiFi
   Serial.println("--- WiFi Setup ---");
@@ -270,17 +613,73 @@ void setup() {
   Serial.println("--- MQTT Setup ---");
   setupConnectedMessages();
   setupMqttTopics(PRYSMA_ID);
+  setupGroupTopics(config.groups, config.numGroups);
   onMqttConnect(handleConnect);
   onMqttMessage(handleMessage);
 
+  // Scheduled commands need every light to agree on the time
+  Serial.println("--- Clock Setup ---");
+  setupClock(config.ntpServer);
+
+  // Commands over a local WebSocket skip the broker but take the same path as
+  // MQTT commands, so MQTT still gets every state change
+  if (config.webSocket) {
+    Serial.println("--- WebSocket Setup ---");
+    setupWebSocket(config.webSocketPassword);
+    onWebSocketCommand(handleWebSocketCommand);
+    onWebSocketConnect(handleWebSocketConnect);
+  }
+
   // Initialize the light
   light.init(config.numLeds, config.stripType, config.colorOrder,
-             config.dataPin, config.clockPin, config.maxBrightness);
+             config.dataPin, config.clockPin, config.maxBrightness,
+             config.ledDriver, config.outputLengths, config.numOutputs);
+  light.setCrossfadeTime(config.crossfadeTime);
+  light.setColorCorrection(config.gamma,
+                           CRGB(config.whitePoint[0], config.whitePoint[1],
+                                config.whitePoint[2]));
+  light.setStream(config.multicastGroup, config.sliceOffset,
+                  config.sliceLength, config.canvasLength);
+  light.setMatrix(config.matrixWidth, config.matrixHeight,
+                  config.matrixSerpentine, config.matrixRotation,
+                  config.matrixOrigin);
+  // Playlists change the effect on their own, so publish those changes
+  light.onStateChange(sendState);
+  // Time how long commands take to show up on the leds
+  light.onShow(traceShow);
+  onTrace(sendTrace);
+
+  // Report the big static allocations and the starting heap
+  Serial.println("--- Telemetry Setup ---");
+  LOG_INFO("sizeof(Light) - %u bytes", sizeof(Light));
+  LOG_INFO("sizeof(Config) - %u bytes", sizeof(Config));
+  LOG_INFO("sizeof(StaticJsonDocument<512>) - %u bytes",
+           sizeof(StaticJsonDocument<512>));
+  LOG_INFO("Command document (static) - %u bytes", COMMAND_DOC_SIZE);
+  setupTelemetry();
+  onTelemetry(sendTelemetry);
+
+#if BENCHMARK_PAYLOADS
+  benchmarkPayloads();
+#endif
+
+  // From here on, log messages are queued and written to serial when there
+  // is time instead of holding up the loop
+  setLogBlocking(false);
+#if PUBLISH_LOG
+  onLogLine(publishLogLine);
+#endif
 }
 
 void loop() {
   handleOTA();
   handleMqtt(PRYSMA_ID, config.mqttUsername, config.mqttPassword,
              CONNECTED_TOPIC, 0, true, disconnectedMessage);
+  handleWebSocket();
+  handleScheduledCommand();
   light.loop();
+  handleStatePublish();
+  handleTrace(light.isTransitioning());
+  handleTelemetry();
+  handleLog();
 }
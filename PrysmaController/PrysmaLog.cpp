@@ -0,0 +1,107 @@
+#include "PrysmaLog.h"
+#include <Arduino.h>  // Enables use of Arduino specific functions and types
+#include <stdarg.h>
+
+// Local Variables
+// Single producer (logPrintf) and single consumer (handleLog), so the ring
+// buffer only needs each side to own its own index
+char logBuffer[LOG_BUFFER_SIZE];
+volatile uint32_t logHead = 0;  // Written by logPrintf
+volatile uint32_t logTail = 0;  // Written by handleLog
+unsigned long droppedLogCount = 0;
+bool logBlocking = true;
+void (*logLineCallback)(const char *line) = NULL;
+char logLine[LOG_LINE_LENGTH];
+size_t logLineLength = 0;
+
+void logPrintf(const char *format, ...) {
+  char message[LOG_LINE_LENGTH];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  if (length < 0) {
+    return;
+  }
+  if (length >= (int)sizeof(message)) {
+    // Keep the line ending on messages that were cut off
+    length = sizeof(message) - 1;
+    message[length - 1] = '\n';
+  }
+
+  // During setup nothing is waiting on the frame rate, so keep messages in
+  // order with anything else written to Serial
+  if (logBlocking) {
+    flushLog();
+    Serial.write((const uint8_t *)message, length);
+    return;
+  }
+
+  uint32_t head = logHead;
+  if ((uint32_t)length > LOG_BUFFER_SIZE - (head - logTail)) {
+    droppedLogCount++;
+    return;
+  }
+  for (int i = 0; i < length; i++) {
+    logBuffer[(head + i) & (LOG_BUFFER_SIZE - 1)] = message[i];
+  }
+  logHead = head + length;
+}
+
+// Hand a drained character to the line callback
+void collectLogLine(char c) {
+  if (c == '\n') {
+    logLine[logLineLength] = '\0';
+    logLineLength = 0;
+    // Anything the callback logs would come straight back to it, so it must
+    // not log
+    logLineCallback(logLine);
+  } else if (logLineLength < sizeof(logLine) - 1) {
+    logLine[logLineLength++] = c;
+  }
+}
+
+void drainLog(uint32_t maxLength) {
+  uint32_t tail = logTail;
+  uint32_t length = min(logHead - tail, maxLength);
+  // At most two writes, one up to the end of the buffer and one after it
+  // wraps around
+  uint32_t start = tail & (LOG_BUFFER_SIZE - 1);
+  uint32_t firstLength = min(length, LOG_BUFFER_SIZE - start);
+  Serial.write((const uint8_t *)&logBuffer[start], firstLength);
+  Serial.write((const uint8_t *)logBuffer, length - firstLength);
+
+  if (logLineCallback) {
+    for (uint32_t i = 0; i < length; i++) {
+      collectLogLine(logBuffer[(tail + i) & (LOG_BUFFER_SIZE - 1)]);
+    }
+  }
+  logTail = tail + length;
+}
+
+void handleLog() {
+  drainLog(Serial.availableForWrite());
+
+  // Report dropped messages once there is room for the report
+  static unsigned long reportedDropCount = 0;
+  if (droppedLogCount != reportedDropCount &&
+      LOG_BUFFER_SIZE - (logHead - logTail) >= LOG_LINE_LENGTH) {
+    LOG_WARNING("Dropped %lu log messages",
+                droppedLogCount - reportedDropCount);
+    reportedDropCount = droppedLogCount;
+  }
+}
+
+void flushLog() {
+  while (logHead != logTail) {
+    drainLog(LOG_BUFFER_SIZE);
+  }
+}
+
+void setLogBlocking(bool blocking) { logBlocking = blocking; }
+
+void onLogLine(void (*callback)(const char *line)) {
+  logLineCallback = callback;
+}
+
+unsigned long getDroppedLogCount() { return droppedLogCount; }
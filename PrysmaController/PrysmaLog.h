@@ -0,0 +1,78 @@
+/*
+  PrysmaLog.h - Library for logging from Prysma-Controller without holding up
+  the render loop
+*/
+#ifndef PrysmaLog_h
+#define PrysmaLog_h
+
+#include <Arduino.h>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+// Messages above this level compile to nothing. Set it in the build flags,
+// for example -DLOG_LEVEL=LOG_LEVEL_DEBUG
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+// Must be a power of 2
+#define LOG_BUFFER_SIZE 2048
+// Longer messages are cut off
+#define LOG_LINE_LENGTH 160
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(format, ...) logPrintf("[ERROR]: " format "\n", ##__VA_ARGS__)
+#else
+#define LOG_ERROR(format, ...) \
+  do {                         \
+  } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARNING
+#define LOG_WARNING(format, ...) \
+  logPrintf("[WARNING]: " format "\n", ##__VA_ARGS__)
+#else
+#define LOG_WARNING(format, ...) \
+  do {                           \
+  } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(format, ...) logPrintf("[INFO]: " format "\n", ##__VA_ARGS__)
+#else
+#define LOG_INFO(format, ...) \
+  do {                        \
+  } while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(format, ...) logPrintf("[DEBUG]: " format "\n", ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...) \
+  do {                         \
+  } while (0)
+#endif
+
+// Queue a message. Use the LOG_ macros instead so the level filtering works
+void logPrintf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+// Write queued messages to Serial, but only as much as fits in the UART FIFO
+// so it never waits on the baud rate
+void handleLog();
+
+// Write every queued message, waiting for Serial if needed
+void flushLog();
+
+// While blocking (the default, for setup) messages are written straight to
+// Serial. Otherwise a full buffer drops messages instead of waiting
+void setLogBlocking(bool blocking);
+
+// Called with every complete line as it is drained, for example to publish
+// the log over MQTT. The callback must not log
+void onLogLine(void (*callback)(const char *line));
+
+unsigned long getDroppedLogCount();
+
+#endif
@@ -3,6 +3,7 @@
 #include <ArduinoJson.h>
 #include <ESP8266mDNS.h>   // Enables finding addresses in the .local domain
 #include <PubSubClient.h>  // MQTT client library
+#include "PrysmaLog.h"
 
 // Local Variables
 WiFiClient wifiClient;
@@ -26,33 +27,87 @@ char CONFIG_TOPIC[50];              // for sending config info
 char DISCOVERY_TOPIC[50];           // for sending config info
 char DISCOVERY_RESPONSE_TOPIC[50];  // for sending config info
 char IDENTIFY_TOPIC[50];            // for sending config info
+char EFFECT_UPLOAD_TOPIC[50];       // for receiving effect programs
+char TELEMETRY_TOPIC[50];           // for sending heap/stack telemetry
+char LOG_TOPIC[50];                 // for sending log lines
+char TRACE_TOPIC[50];               // for sending command latencies
+char EFFECT_LIST_MSGPACK_TOPIC[60];
+char STATE_MSGPACK_TOPIC[60];
+char COMMAND_MSGPACK_TOPIC[60];
+char CONFIG_MSGPACK_TOPIC[60];
+char DISCOVERY_RESPONSE_MSGPACK_TOPIC[60];
+char TELEMETRY_MSGPACK_TOPIC[60];
+char TRACE_MSGPACK_TOPIC[60];
+char GROUP_COMMAND_TOPICS[MAX_GROUPS][50];
+char GROUP_COMMAND_MSGPACK_TOPICS[MAX_GROUPS][60];
+int numGroupTopics = 0;
 
 void setupMqttTopics(char* id) {
   snprintf(CONNECTED_TOPIC, sizeof(CONNECTED_TOPIC), "%s/%s/%s", MQTT_TOP, id,
            MQTT_CONNECTED);
-  Serial.printf("[INFO]: Connected Topic - %s\n", CONNECTED_TOPIC);
+  LOG_INFO("Connected Topic - %s", CONNECTED_TOPIC);
   snprintf(EFFECT_LIST_TOPIC, sizeof(CONNECTED_TOPIC), "%s/%s/%s", MQTT_TOP, id,
            MQTT_EFFECT_LIST);
-  Serial.printf("[INFO]: Effect List Topic - %s\n", EFFECT_LIST_TOPIC);
+  LOG_INFO("Effect List Topic - %s", EFFECT_LIST_TOPIC);
   snprintf(STATE_TOPIC, sizeof(CONNECTED_TOPIC), "%s/%s/%s", MQTT_TOP, id,
            MQTT_STATE);
-  Serial.printf("[INFO]: State Topic - %s\n", STATE_TOPIC);
+  LOG_INFO("State Topic - %s", STATE_TOPIC);
   snprintf(COMMAND_TOPIC, sizeof(CONNECTED_TOPIC), "%s/%s/%s", MQTT_TOP, id,
            MQTT_COMMAND);
-  Serial.printf("[INFO]: Command Topic - %s\n", COMMAND_TOPIC);
+  LOG_INFO("Command Topic - %s", COMMAND_TOPIC);
   snprintf(CONFIG_TOPIC, sizeof(CONNECTED_TOPIC), "%s/%s/%s", MQTT_TOP, id,
            MQTT_CONFIG);
-  Serial.printf("[INFO]: Config Topic - %s\n", CONFIG_TOPIC);
+  LOG_INFO("Config Topic - %s", CONFIG_TOPIC);
   snprintf(DISCOVERY_TOPIC, sizeof(DISCOVERY_TOPIC), "%s/%s", MQTT_TOP,
            MQTT_DISCOVERY);
-  Serial.printf("[INFO]: Discovery Topic - %s\n", DISCOVERY_TOPIC);
+  LOG_INFO("Discovery Topic - %s", DISCOVERY_TOPIC);
   snprintf(DISCOVERY_RESPONSE_TOPIC, sizeof(DISCOVERY_RESPONSE_TOPIC),
            "%s/%s/%s", MQTT_TOP, id, MQTT_DISCOVERY_RESPONSE);
-  Serial.printf("[INFO]: Discovery Response Topic - %s\n",
-                DISCOVERY_RESPONSE_TOPIC);
+  LOG_INFO("Discovery Response Topic - %s", DISCOVERY_RESPONSE_TOPIC);
   snprintf(IDENTIFY_TOPIC, sizeof(IDENTIFY_TOPIC), "%s/%s/%s", MQTT_TOP, id,
            MQTT_IDENTIFY);
-  Serial.printf("[INFO]: Identify Topic - %s\n", IDENTIFY_TOPIC);
+  LOG_INFO("Identify Topic - %s", IDENTIFY_TOPIC);
+  snprintf(EFFECT_UPLOAD_TOPIC, sizeof(EFFECT_UPLOAD_TOPIC), "%s/%s/%s",
+           MQTT_TOP, id, MQTT_EFFECT_UPLOAD);
+  LOG_INFO("Effect Upload Topic - %s", EFFECT_UPLOAD_TOPIC);
+  snprintf(TELEMETRY_TOPIC, sizeof(TELEMETRY_TOPIC), "%s/%s/%s", MQTT_TOP, id,
+           MQTT_TELEMETRY);
+  LOG_INFO("Telemetry Topic - %s", TELEMETRY_TOPIC);
+  snprintf(LOG_TOPIC, sizeof(LOG_TOPIC), "%s/%s/%s", MQTT_TOP, id, MQTT_LOG);
+  LOG_INFO("Log Topic - %s", LOG_TOPIC);
+  snprintf(TRACE_TOPIC, sizeof(TRACE_TOPIC), "%s/%s/%s", MQTT_TOP, id,
+           MQTT_TRACE);
+  LOG_INFO("Trace Topic - %s", TRACE_TOPIC);
+
+  // MessagePack topics are the JSON topics with a suffix
+  snprintf(EFFECT_LIST_MSGPACK_TOPIC, sizeof(EFFECT_LIST_MSGPACK_TOPIC),
+           "%s/%s", EFFECT_LIST_TOPIC, MQTT_MSGPACK);
+  snprintf(STATE_MSGPACK_TOPIC, sizeof(STATE_MSGPACK_TOPIC), "%s/%s",
+           STATE_TOPIC, MQTT_MSGPACK);
+  snprintf(COMMAND_MSGPACK_TOPIC, sizeof(COMMAND_MSGPACK_TOPIC), "%s/%s",
+           COMMAND_TOPIC, MQTT_MSGPACK);
+  LOG_INFO("Command MessagePack Topic - %s", COMMAND_MSGPACK_TOPIC);
+  snprintf(CONFIG_MSGPACK_TOPIC, sizeof(CONFIG_MSGPACK_TOPIC), "%s/%s",
+           CONFIG_TOPIC, MQTT_MSGPACK);
+  snprintf(DISCOVERY_RESPONSE_MSGPACK_TOPIC,
+           sizeof(DISCOVERY_RESPONSE_MSGPACK_TOPIC), "%s/%s",
+           DISCOVERY_RESPONSE_TOPIC, MQTT_MSGPACK);
+  snprintf(TELEMETRY_MSGPACK_TOPIC, sizeof(TELEMETRY_MSGPACK_TOPIC), "%s/%s",
+           TELEMETRY_TOPIC, MQTT_MSGPACK);
+  snprintf(TRACE_MSGPACK_TOPIC, sizeof(TRACE_MSGPACK_TOPIC), "%s/%s",
+           TRACE_TOPIC, MQTT_MSGPACK);
+}
+
+void setupGroupTopics(char groups[][16], int numGroups) {
+  numGroupTopics = min(numGroups, MAX_GROUPS);
+  for (int i = 0; i < numGroupTopics; i++) {
+    snprintf(GROUP_COMMAND_TOPICS[i], sizeof(GROUP_COMMAND_TOPICS[i]),
+             "%s/%s/%s/%s", MQTT_TOP, MQTT_GROUP, groups[i], MQTT_COMMAND);
+    LOG_INFO("Group Command Topic - %s", GROUP_COMMAND_TOPICS[i]);
+    snprintf(GROUP_COMMAND_MSGPACK_TOPICS[i],
+             sizeof(GROUP_COMMAND_MSGPACK_TOPICS[i]), "%s/%s",
+             GROUP_COMMAND_TOPICS[i], MQTT_MSGPACK);
+  }
 }
 
 long lastQueryAttempt = 0;
@@ -62,21 +117,19 @@ MqttBroker findMqttBroker() {
 
   // If none were found, return null;
   if (n == 0) {
-    Serial.println("[WARNING]: No MQTT services found");
+    LOG_WARNING("No MQTT services found");
     return {false};
   }
 
   // Loop through all the services found and pick the best one
-  Serial.println("--- MDNS Query Results ---");
   for (int i = 0; i < n; ++i) {
     String SERVICE_NAME = MDNS.hostname(i);
     IPAddress SERVICE_IP = MDNS.IP(i);
     uint16_t SERVICE_PORT = MDNS.port(i);
-    Serial.printf("[INFO]: MDNS Result %i:\n", i);
-    Serial.println("[INFO]: SERVICE Hostname - " + SERVICE_NAME);
-    Serial.println("[INFO]: SERVICE Host IP - " + SERVICE_IP.toString());
-    Serial.printf("[INFO]: SERVICE Port - %i\n", SERVICE_PORT);
-    Serial.println("------");
+    LOG_INFO("MDNS Result %i:", i);
+    LOG_INFO("SERVICE Hostname - %s", SERVICE_NAME.c_str());
+    LOG_INFO("SERVICE Host IP - %s", SERVICE_IP.toString().c_str());
+    LOG_INFO("SERVICE Port - %i", SERVICE_PORT);
 
     // Services at prysma.local take priority
     if (SERVICE_NAME.indexOf("prysma") >= 0) {
@@ -87,8 +140,6 @@ MqttBroker findMqttBroker() {
 
   // If there were no services with the hostname prysma.local, just return the
   // first ip address that came up
-  char mqttBrokerIp[16];
-  MDNS.IP(0).toString().toCharArray(mqttBrokerIp, sizeof(mqttBrokerIp));
   MqttBroker mqttBroker = {true, MDNS.hostname(0), MDNS.IP(0), MDNS.port(0)};
   return mqttBroker;
 }
@@ -99,18 +150,19 @@ boolean connectToMQTT(const char* id, const char* user, const char* pass,
   // Find and set the mqtt broker
   MqttBroker mqttBroker = findMqttBroker();
   if (!mqttBroker.wasFound) {
-    Serial.println("[WARNING]: MQTT Broker Not Found");
+    LOG_WARNING("MQTT Broker Not Found");
     return false;
   }
-  Serial.println("[INFO]: Attempting connection to MQTT broker at " +
-                 mqttBroker.hostname + "...");
+  // printf instead of String concatenation, which leaves holes in the heap
+  LOG_INFO("Attempting connection to MQTT broker at %s...",
+           mqttBroker.hostname.c_str());
   mqttClient.setServer(mqttBroker.ip, mqttBroker.port);
 
   if (mqttClient.connect(id, user, pass, willTopic, willQos, willRetain,
                          willMessage)) {
-    Serial.println("[INFO]: Connected to MQTT broker at " +
-                   mqttBroker.hostname + " - " + mqttBroker.ip.toString() +
-                   ":" + mqttBroker.port);
+    LOG_INFO("Connected to MQTT broker at %s - %s:%u",
+             mqttBroker.hostname.c_str(), mqttBroker.ip.toString().c_str(),
+             mqttBroker.port);
 
     connectCallback();
   }
@@ -131,9 +183,8 @@ void handleMqtt(const char* id, const char* user, const char* pass,
                         willMessage)) {
         lastMqttConnectionAttempt = 0;
       } else {
-        Serial.print("[WARNING]: Failed MQTT Connection, rc=");
-        Serial.println(mqttClient.state());
-        Serial.println("[INFO]: Attempting again in 5 seconds");
+        LOG_WARNING("Failed MQTT Connection, rc=%i", mqttClient.state());
+        LOG_INFO("Attempting again in 5 seconds");
       }
     }
   } else {
@@ -20,6 +20,13 @@
 #define MQTT_DISCOVERY "discovery"
 #define MQTT_DISCOVERY_RESPONSE "discoveryResponse"
 #define MQTT_IDENTIFY "identify"
+#define MQTT_EFFECT_UPLOAD "effectUpload"
+#define MQTT_TELEMETRY "telemetry"
+#define MQTT_LOG "log"
+#define MQTT_TRACE "trace"
+#define MQTT_MSGPACK "msgpack"  // Suffix for MessagePack versions of topics
+#define MQTT_GROUP "group"
+#define MAX_GROUPS 4
 
 // These need to be extern or else you get a "multiple definition" error
 extern char CONNECTED_TOPIC[50];           // for sending connection messages
@@ -30,11 +37,29 @@ extern char CONFIG_TOPIC[50];              // for sending config info
 extern char DISCOVERY_TOPIC[50];           // for receiving discovery queries
 extern char DISCOVERY_RESPONSE_TOPIC[50];  // for sending discovery responses
 extern char IDENTIFY_TOPIC[50];            // for receiving identify commands
+extern char EFFECT_UPLOAD_TOPIC[50];       // for receiving effect programs
+extern char TELEMETRY_TOPIC[50];           // for sending heap/stack telemetry
+extern char LOG_TOPIC[50];                 // for sending log lines
+extern char TRACE_TOPIC[50];               // for sending command latencies
+// MessagePack versions of the JSON topics
+extern char EFFECT_LIST_MSGPACK_TOPIC[60];
+extern char STATE_MSGPACK_TOPIC[60];
+extern char COMMAND_MSGPACK_TOPIC[60];
+extern char CONFIG_MSGPACK_TOPIC[60];
+extern char DISCOVERY_RESPONSE_MSGPACK_TOPIC[60];
+extern char TELEMETRY_MSGPACK_TOPIC[60];
+extern char TRACE_MSGPACK_TOPIC[60];
+// Commands sent to every light in a group
+extern char GROUP_COMMAND_TOPICS[MAX_GROUPS][50];
+extern char GROUP_COMMAND_MSGPACK_TOPICS[MAX_GROUPS][60];
+extern int numGroupTopics;
 
 extern PubSubClient mqttClient;
 
 void setupMqttTopics(char* id);
 
+void setupGroupTopics(char groups[][16], int numGroups);
+
 void handleMqtt(const char* id, const char* user, const char* pass,
                           const char* willTopic, uint8_t willQos,
                           boolean willRetain, const char* willMessage);
@@ -3,9 +3,10 @@
 #include <ArduinoOTA.h>
 #include <ESP8266mDNS.h>
 #include <WiFiUdp.h>
+#include "PrysmaLog.h"
 
 void setupOTA(char *hostname) {
-  Serial.println("[INFO]: OTA Initializing");
+  LOG_INFO("OTA Initializing");
 
   ArduinoOTA.onStart([]() {
     String type;
@@ -17,29 +18,41 @@ void setupOTA(char *hostname) {
 
     // NOTE: if updating SPIFFS this would be the place to unmount SPIFFS using
     // SPIFFS.end()
-    Serial.println("[INFO]: OTA Start updating " + type);
+    // The main loop doesn't run during the update, so nothing would drain
+    // queued messages
+    setLogBlocking(true);
+    LOG_INFO("OTA Start updating %s", type.c_str());
     digitalWrite(LED_BUILTIN, LOW);
   });
   ArduinoOTA.onEnd([]() {
-    Serial.println("\n[INFO]: OTA End");
+    LOG_INFO("OTA End");
     digitalWrite(LED_BUILTIN, HIGH);
   });
   ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
-    Serial.printf("[INFO]: Progress - %u%%\r", (progress / (total / 100)));
+    // Called for every chunk, so only log when the percentage changes
+    static unsigned int lastPercent = 101;
+    unsigned int percent = progress / (total / 100);
+    if (percent != lastPercent) {
+      LOG_DEBUG("OTA Progress - %u%%", percent);
+      lastPercent = percent;
+    }
   });
   ArduinoOTA.onError([](ota_error_t error) {
-    Serial.printf("[Error]: (%u) - ", error);
+    const char *reason = "Unknown";
     if (error == OTA_AUTH_ERROR) {
-      Serial.println("Auth Failed");
+      reason = "Auth Failed";
     } else if (error == OTA_BEGIN_ERROR) {
-      Serial.println("Begin Failed");
+      reason = "Begin Failed";
     } else if (error == OTA_CONNECT_ERROR) {
-      Serial.println("Connect Failed");
+      reason = "Connect Failed";
     } else if (error == OTA_RECEIVE_ERROR) {
-      Serial.println("Receive Failed");
+      reason = "Receive Failed";
     } else if (error == OTA_END_ERROR) {
-      Serial.println("End Failed");
+      reason = "End Failed";
     }
+    LOG_ERROR("OTA (%u) - %s", error, reason);
+    // Back to the main loop, which drains the log again
+    setLogBlocking(false);
   });
 
   // Port defaults to 8266
@@ -55,7 +68,7 @@ void setupOTA(char *hostname) {
   ArduinoOTA.setHostname(hostname);
   ArduinoOTA.begin();
 
-  Serial.println("[INFO]: OTA Ready");
+  LOG_INFO("OTA Ready");
 }
 
 void handleOTA() { ArduinoOTA.handle(); }
\ No newline at end of file
@@ -0,0 +1,55 @@
+#include "PrysmaTelemetry.h"
+#include <Arduino.h>  // Enables use of Arduino specific functions and types
+#include "PrysmaLog.h"
+
+// Local Variables
+void (*telemetryCallback)() = NULL;
+MemoryStats currentStats;
+MemoryStats worstStats;
+unsigned long lastSampleTime = 0;
+unsigned long lastPublishTime = 0;
+
+void sampleMemoryStats() {
+  currentStats.freeHeap = ESP.getFreeHeap();
+  currentStats.maxFreeBlock = ESP.getMaxFreeBlockSize();
+  currentStats.fragmentation = ESP.getHeapFragmentation();
+  // The loop stack is painted on boot, so this is already a high-water mark
+  currentStats.freeStack = ESP.getFreeContStack();
+
+  worstStats.freeHeap = min(worstStats.freeHeap, currentStats.freeHeap);
+  worstStats.maxFreeBlock =
+      min(worstStats.maxFreeBlock, currentStats.maxFreeBlock);
+  worstStats.fragmentation =
+      max(worstStats.fragmentation, currentStats.fragmentation);
+  worstStats.freeStack = min(worstStats.freeStack, currentStats.freeStack);
+}
+
+void setupTelemetry() {
+  sampleMemoryStats();
+  worstStats = currentStats;
+  LOG_INFO("Free Heap - %u bytes", currentStats.freeHeap);
+  LOG_INFO("Largest Free Block - %u bytes", currentStats.maxFreeBlock);
+  LOG_INFO("Heap Fragmentation - %u%%", currentStats.fragmentation);
+}
+
+void handleTelemetry() {
+  unsigned long now = millis();
+  // Walking the heap isn't free, so only sample once in a while
+  if (now - lastSampleTime >= TELEMETRY_SAMPLE_INTERVAL) {
+    lastSampleTime = now;
+    sampleMemoryStats();
+  }
+
+  if (now - lastPublishTime >= TELEMETRY_PUBLISH_INTERVAL) {
+    lastPublishTime = now;
+    if (telemetryCallback) {
+      telemetryCallback();
+    }
+  }
+}
+
+void onTelemetry(void (*callback)()) { telemetryCallback = callback; }
+
+MemoryStats getMemoryStats() { return currentStats; }
+
+MemoryStats getWorstMemoryStats() { return worstStats; }
@@ -0,0 +1,32 @@
+/*
+  PrysmaTelemetry.h - Library for tracking heap and stack usage of
+  Prysma-Controller
+*/
+#ifndef PrysmaTelemetry_h
+#define PrysmaTelemetry_h
+
+#include <Arduino.h>
+
+#define TELEMETRY_SAMPLE_INTERVAL 1000    // In ms
+#define TELEMETRY_PUBLISH_INTERVAL 60000  // In ms
+
+typedef struct {
+  uint32_t freeHeap;
+  uint16_t maxFreeBlock;
+  uint8_t fragmentation;  // In %
+  uint32_t freeStack;     // Least free loop stack since boot
+} MemoryStats;
+
+void setupTelemetry();
+
+void handleTelemetry();
+
+void onTelemetry(void (*callback)());
+
+MemoryStats getMemoryStats();
+
+// Worst values since boot (lowest free heap, block and stack, highest
+// fragmentation)
+MemoryStats getWorstMemoryStats();
+
+#endif
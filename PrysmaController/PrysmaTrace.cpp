@@ -0,0 +1,102 @@
+#include "PrysmaTrace.h"
+#include <Arduino.h>  // Enables use of Arduino specific functions and types
+#include "PrysmaLog.h"
+
+enum TracePhase { TRACE_IDLE, TRACE_WAITING_FOR_SHOW, TRACE_IN_TRANSITION };
+
+// Local Variables
+void (*traceCallback)(const CommandTrace& trace) = NULL;
+CommandTrace currentTrace;
+TracePhase tracePhase = TRACE_IDLE;
+unsigned long receivedTime = 0;  // In us
+// Rings of the latest samples for the percentiles
+uint32_t showSamples[TRACE_SAMPLES];
+uint32_t transitionSamples[TRACE_SAMPLES];
+uint16_t traceIndex = 0;
+uint16_t traceCount = 0;
+
+void traceCommandReceived() { receivedTime = micros(); }
+
+void traceTransitionStart(const char* mutationId) {
+  if (tracePhase != TRACE_IDLE) {
+    LOG_DEBUG("Trace of %s replaced before it finished",
+              currentTrace.mutationId);
+  }
+  strlcpy(currentTrace.mutationId,           // <- destination
+          mutationId,                        // <- source
+          sizeof(currentTrace.mutationId));  // <- destination's capacity
+  // Later commands can arrive while this one is still being traced, so it
+  // keeps its own copy of when it was received
+  currentTrace.receivedTime = receivedTime;
+  currentTrace.transitionStart = micros() - currentTrace.receivedTime;
+  currentTrace.firstShow = 0;
+  currentTrace.transitionEnd = 0;
+  tracePhase = TRACE_WAITING_FOR_SHOW;
+}
+
+void traceShow() {
+  if (tracePhase == TRACE_WAITING_FOR_SHOW) {
+    currentTrace.firstShow = micros() - currentTrace.receivedTime;
+    tracePhase = TRACE_IN_TRANSITION;
+  }
+}
+
+void handleTrace(bool inTransition) {
+  if (tracePhase == TRACE_WAITING_FOR_SHOW) {
+    // Commands that don't change anything on the leds never get shown
+    if (micros() - currentTrace.receivedTime > TRACE_SHOW_TIMEOUT * 1000UL) {
+      LOG_DEBUG("Trace of %s never got shown", currentTrace.mutationId);
+      tracePhase = TRACE_IDLE;
+    }
+    return;
+  }
+  if (tracePhase != TRACE_IN_TRANSITION || inTransition) {
+    return;
+  }
+
+  currentTrace.transitionEnd = micros() - currentTrace.receivedTime;
+  tracePhase = TRACE_IDLE;
+  showSamples[traceIndex] = currentTrace.firstShow;
+  transitionSamples[traceIndex] = currentTrace.transitionEnd;
+  traceIndex = (traceIndex + 1) % TRACE_SAMPLES;
+  if (traceCount < TRACE_SAMPLES) {
+    traceCount++;
+  }
+  LOG_DEBUG("Trace of %s - start %lu us, show %lu us, end %lu us",
+            currentTrace.mutationId, currentTrace.transitionStart,
+            currentTrace.firstShow, currentTrace.transitionEnd);
+  if (traceCallback) {
+    traceCallback(currentTrace);
+  }
+}
+
+void onTrace(void (*callback)(const CommandTrace& trace)) {
+  traceCallback = callback;
+}
+
+LatencySummary summarize(const uint32_t* samples) {
+  LatencySummary summary = {0, 0, 0, 0};
+  summary.count = traceCount;
+  if (summary.count == 0) {
+    return summary;
+  }
+
+  // Insertion sort a copy, there are only a few samples
+  uint32_t sorted[TRACE_SAMPLES];
+  for (int i = 0; i < summary.count; i++) {
+    uint32_t sample = samples[i];
+    int j = i;
+    for (; j > 0 && sorted[j - 1] > sample; j--) {
+      sorted[j] = sorted[j - 1];
+    }
+    sorted[j] = sample;
+  }
+  summary.p50 = sorted[(summary.count - 1) * 50 / 100];
+  summary.p95 = sorted[(summary.count - 1) * 95 / 100];
+  summary.max = sorted[summary.count - 1];
+  return summary;
+}
+
+LatencySummary getShowLatency() { return summarize(showSamples); }
+
+LatencySummary getTransitionLatency() { return summarize(transitionSamples); }
@@ -0,0 +1,49 @@
+/*
+  PrysmaTrace.h - Library for timing how long commands to Prysma-Controller
+  take to show up on the leds
+*/
+#ifndef PrysmaTrace_h
+#define PrysmaTrace_h
+
+#include <Arduino.h>
+
+#define TRACE_SAMPLES 64         // Commands kept for the latency percentiles
+#define TRACE_SHOW_TIMEOUT 1000  // In ms, for commands that never get shown
+
+// Every phase is in us since the command was received
+typedef struct {
+  char mutationId[37];    // Empty if the command didn't have one
+  uint32_t receivedTime;  // micros() when the command was received
+  uint32_t transitionStart;
+  uint32_t firstShow;
+  uint32_t transitionEnd;
+} CommandTrace;
+
+typedef struct {
+  uint32_t p50;  // In us
+  uint32_t p95;
+  uint32_t max;
+  uint16_t count;
+} LatencySummary;
+
+// Call when a command arrives, before it is parsed. Only for commands, so
+// other messages don't move the start of the trace
+void traceCommandReceived();
+
+// Call just before the command is applied to the light
+void traceTransitionStart(const char* mutationId);
+
+// Call after every frame is sent to the leds
+void traceShow();
+
+void handleTrace(bool inTransition);
+
+void onTrace(void (*callback)(const CommandTrace& trace));
+
+// From receipt to the first frame that shows the command
+LatencySummary getShowLatency();
+
+// From receipt to the end of the transition the command started
+LatencySummary getTransitionLatency();
+
+#endif
@@ -0,0 +1,130 @@
+#include "PrysmaWebSocket.h"
+#include <Arduino.h>  // Enables use of Arduino specific functions and types
+#include <ArduinoJson.h>
+#include <WebSocketsServer.h>
+#include "PrysmaLog.h"
+
+// Local Variables
+WebSocketsServer webSocket(WEBSOCKET_PORT);
+bool webSocketStarted = false;
+const char *webSocketPassword = NULL;
+void (*commandCallback)(byte *payload, unsigned int length,
+                        bool msgpack) = NULL;
+void (*webSocketConnectCallback)(uint8_t client) = NULL;
+// Only clients that have sent the password count as connected
+bool clientConnected[WEBSOCKETS_SERVER_CLIENT_MAX];
+bool clientUsesMsgPack[WEBSOCKETS_SERVER_CLIENT_MAX];
+
+// The first message from a client has to be the password. Anything else gets
+// the client disconnected
+void authenticateClient(uint8_t client, uint8_t *payload, size_t length,
+                        bool msgpack) {
+  StaticJsonDocument<128> doc;
+  DeserializationError error = msgpack
+                                   ? deserializeMsgPack(doc, payload, length)
+                                   : deserializeJson(doc, payload, length);
+  const char *password = doc["password"];
+  if (error || password == NULL ||
+      strcmp(password, webSocketPassword) != 0) {
+    LOG_WARNING("WebSocket client %u sent the wrong password", client);
+    webSocket.disconnect(client);
+    return;
+  }
+  LOG_INFO("WebSocket client %u logged in", client);
+  clientConnected[client] = true;
+  clientUsesMsgPack[client] = msgpack;
+  if (webSocketConnectCallback) {
+    webSocketConnectCallback(client);
+  }
+}
+
+void handleWebSocketEvent(uint8_t client, WStype_t type, uint8_t *payload,
+                          size_t length) {
+  switch (type) {
+    case WStype_CONNECTED:
+      LOG_INFO("WebSocket client %u connected", client);
+      clientConnected[client] = false;
+      break;
+    case WStype_DISCONNECTED:
+      LOG_INFO("WebSocket client %u disconnected", client);
+      clientConnected[client] = false;
+      break;
+    case WStype_TEXT:
+      if (!clientConnected[client]) {
+        authenticateClient(client, payload, length, false);
+        break;
+      }
+      clientUsesMsgPack[client] = false;
+      if (commandCallback) {
+        commandCallback(payload, length, false);
+      }
+      break;
+    case WStype_BIN:
+      if (!clientConnected[client]) {
+        authenticateClient(client, payload, length, true);
+        break;
+      }
+      clientUsesMsgPack[client] = true;
+      if (commandCallback) {
+        commandCallback(payload, length, true);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void setupWebSocket(const char *password) {
+  // Commands skip the MQTT login, so never take them from just anyone
+  if (password == NULL || password[0] == '\0') {
+    LOG_ERROR("Not starting the WebSocket server without a password");
+    return;
+  }
+  webSocketPassword = password;
+  webSocket.begin();
+  webSocket.onEvent(handleWebSocketEvent);
+  webSocketStarted = true;
+  LOG_INFO("WebSocket listening on port %u", WEBSOCKET_PORT);
+}
+
+// Only reads whatever has already arrived, so it never holds up the render
+// loop waiting on a client
+void handleWebSocket() {
+  if (webSocketStarted) {
+    webSocket.loop();
+  }
+}
+
+void onWebSocketCommand(void (*callback)(byte *payload, unsigned int length,
+                                         bool msgpack)) {
+  commandCallback = callback;
+}
+
+void onWebSocketConnect(void (*callback)(uint8_t client)) {
+  webSocketConnectCallback = callback;
+}
+
+void sendWebSocketDocument(JsonDocument &doc, int client) {
+  // One pass per format, so each format is serialized at most once no matter
+  // how many clients there are and only one buffer sits on the stack
+  char message[512];
+  for (int pass = 0; pass < 2; pass++) {
+    bool msgpack = pass == 1;
+    size_t length = 0;
+    for (uint8_t i = 0; i < WEBSOCKETS_SERVER_CLIENT_MAX; i++) {
+      if (!clientConnected[i] || clientUsesMsgPack[i] != msgpack ||
+          (client >= 0 && client != i)) {
+        continue;
+      }
+      if (length == 0) {
+        length = msgpack ? serializeMsgPack(doc, message, sizeof(message))
+                         : serializeJson(doc, message, sizeof(message));
+      }
+      if (msgpack) {
+        webSocket.sendBIN(i, (uint8_t *)message, length);
+      } else {
+        webSocket.sendTXT(i, message, length);
+      }
+    }
+  }
+}
@@ -0,0 +1,33 @@
+/*
+  PrysmaWebSocket.h - Library for controlling Prysma-Controller over a local
+  WebSocket without going through the Mqtt broker
+*/
+#ifndef PrysmaWebSocket_h
+#define PrysmaWebSocket_h
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <WebSocketsServer.h>
+
+#define WEBSOCKET_PORT 81
+
+// Clients have to send {"password": "<password>"} as their first message,
+// as JSON or MessagePack, before they get anything else. The server doesn't
+// start without a password
+void setupWebSocket(const char *password);
+
+void handleWebSocket();
+
+// Text frames are JSON commands and binary frames are MessagePack commands,
+// the same as the command topics
+void onWebSocketCommand(void (*callback)(byte *payload, unsigned int length,
+                                         bool msgpack));
+
+// Called once a client has sent the password
+void onWebSocketConnect(void (*callback)(uint8_t client));
+
+// Send to one client, or every client if client is -1. Each client gets the
+// format it last sent a command in
+void sendWebSocketDocument(JsonDocument &doc, int client);
+
+#endif
@@ -2,6 +2,7 @@
 #include <Arduino.h>      // Enables use of Arduino specific functions and types
 #include <ESP8266WiFi.h>  // ESP8266 Core WiFi Library
 #include <WiFiManager.h>  // https://github.com/tzapu/WiFiManager WiFi Configuration Magic
+#include "PrysmaLog.h"
 
 void setupWifi(char *accessPointName) {
   // Autoconnect to Wifi
@@ -22,15 +23,14 @@ void setupWifi(char *accessPointName) {
   digitalWrite(LED_BUILTIN, LOW);
 
   if (!wifiManager.autoConnect(accessPointName)) {
-    Serial.println("[ERROR]: failed to connect to Wifi");
-    Serial.println("[DEBUG]: try resetting the module");
+    LOG_ERROR("failed to connect to Wifi");
+    LOG_DEBUG("try resetting the module");
     delay(3000);
     ESP.reset();
     delay(5000);
   }
   // Turn the built in LED off when connected to WIFI
   digitalWrite(LED_BUILTIN, HIGH);
-  Serial.println("[INFO]: Connected to Wifi :)");
-  Serial.print("[INFO]: IP address: ");
-  Serial.println(WiFi.localIP());
+  LOG_INFO("Connected to Wifi :)");
+  LOG_INFO("IP address: %s", WiFi.localIP().toString().c_str());
 }
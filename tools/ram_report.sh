@@ -0,0 +1,40 @@
+#!/usr/bin/env bash
+#
+# ram_report.sh - Report the static RAM used by the biggest objects in a
+# Prysma-Controller build
+#
+# Usage: tools/ram_report.sh [elf] [toolchain prefix]
+#   elf               defaults to build/PrysmaController.ino.elf
+#   toolchain prefix  defaults to xtensa-lx106-elf- (must be on the PATH)
+
+ELF=${1:-build/PrysmaController.ino.elf}
+PREFIX=${2-xtensa-lx106-elf-}
+NM="${PREFIX}nm"
+SIZE="${PREFIX}size"
+
+if [ ! -f "$ELF" ]; then
+  echo "[ERROR]: $ELF not found, build the sketch first" >&2
+  exit 1
+fi
+
+# Size of one global object in bytes (0 if it was optimized out)
+symbol_size() {
+  "$NM" -C -S -t d "$ELF" | awk -v name="$1" \
+    '$3 ~ /^[bBdD]$/ && $4 == name { print $2 + 0; found = 1 }
+     END { if (!found) print 0 }'
+}
+
+echo "--- Static RAM Report ---"
+"$SIZE" -A "$ELF" | awk '$1 ~ /^\.(data|rodata|bss)$/ { printf "%-8s %7d bytes\n", $1, $2; total += $2 }
+  END { printf "%-8s %7d bytes of 81920\n", "total", total }'
+
+echo "--- Globals ---"
+printf "%-8s %7d bytes\n" "light" "$(symbol_size light)"
+printf "%-8s %7d bytes\n" "config" "$(symbol_size config)"
+# The JSON documents live on the stack while a message is built, so they only
+# show up in the loop stack high-water mark from the telemetry topic
+echo "StaticJsonDocument<512> is on the stack, see sizeof on boot"
+
+echo "--- 10 Largest RAM Symbols ---"
+"$NM" -C -S -t d --size-sort "$ELF" | awk '$3 ~ /^[bBdD]$/' | tail -n 10 |
+  awk '{ size = $2 + 0; $1 = $2 = $3 = ""; sub(/^ +/, ""); printf "%7d bytes  %s\n", size, $0 }'
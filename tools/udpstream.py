@@ -0,0 +1,498 @@
+#!/usr/bin/env python3
+"""
+udpstream.py - Generate, record and replay Visualize streams for
+Prysma-Controller, and simulate a controller to send them to
+
+Usage:
+  tools/udpstream.py generate <host> [--leds 150] [--fps 60] [--seconds 10]
+                     [--loss 0.05] [--reorder 0.02] [--jitter 20] [--adapt]
+  tools/udpstream.py record <file> [--seconds 30]
+  tools/udpstream.py replay <file> <host> [--loss ...] [--no-tag]
+  tools/udpstream.py simulate [--leds 150] [--show-time 4500]
+
+Every frame sent by generate and replay carries its frame number in pixel 0
+(24 bits, big endian). With --header or --interpolate, frames also start
+with the stream header (see README.md). Build the controller with STREAM_ECHO
+set to 1 in Light.h, or point the stream at the simulator, and it sends back
+an 'R' when a frame is received and an 'S' when it is shown. Those are
+counted into the delivered and shown totals and the latency from when the
+frame was due to be sent until it was shown (including the trip back).
+
+The controller (and the simulator) also sends a report every second while
+it's being streamed to, with what happened to the frames since the last one.
+Those are summed up at the end, and generate --adapt uses them to lower the
+frame rate while frames are being dropped and raise it again after.
+"""
+import argparse
+import heapq
+import math
+import random
+import select
+import socket
+import struct
+import sys
+import time
+
+STREAM_PORT = 7778
+FRAMES_PER_SECOND = 60  # Controller output rate, see Light.h
+RECORD_MAGIC = b"PRYSREC1"
+RECORD_HEADER = struct.Struct("<dH")  # Seconds since start, payload length
+MAX_PACKET = 65507
+ECHO_WAIT = 1.0  # Seconds to keep listening for echoes after the last frame
+# "PRYS", flags, reserved, 16 bit big endian sequence, see Light.h
+STREAM_HEADER = struct.Struct(">4sBBH")
+STREAM_MAGIC = b"PRYS"
+STREAM_FLAG_INTERPOLATE = 0x01
+STREAM_TIMEOUT = 1.0  # Seconds without frames before any sequence is taken
+# "PRYR", version, reserved, last sequence, interval ms, received, shown,
+# dropped, late, average render us, average show us, see README.md
+STREAM_REPORT = struct.Struct(">4sBBHIIIIIII")
+STREAM_REPORT_MAGIC = b"PRYR"
+STREAM_REPORT_VERSION = 1
+ADAPT_THRESHOLD = 0.05  # Share of received frames that can go missing
+MIN_FPS = 5
+
+
+# ************************************************************************
+# Frames
+# ************************************************************************
+def rainbow_frame(num_leds, t):
+    frame = bytearray(num_leds * 3)
+    for i in range(num_leds):
+        hue = (i * 3 + t * 120) % 360
+        x = 1 - abs((hue / 60) % 2 - 1)
+        r, g, b = [(1, x, 0), (x, 1, 0), (0, 1, x), (0, x, 1), (x, 0, 1),
+                   (1, 0, x)][int(hue // 60)]
+        frame[i * 3:i * 3 + 3] = bytes((int(r * 255), int(g * 255),
+                                        int(b * 255)))
+    return frame
+
+
+def tag_frame(frame, number, tag_every):
+    # Pixel 0 of every slice carries the frame number so sliced lights can
+    # echo it too
+    tagged = bytearray(frame)
+    tag = struct.pack(">I", number & 0xFFFFFF)[1:]
+    for led in range(0, len(tagged) // 3, tag_every):
+        tagged[led * 3:led * 3 + 3] = tag
+    return tagged
+
+
+def read_tag(payload):
+    return struct.unpack(">I", b"\0" + bytes(payload[:3]))[0]
+
+
+def split_header(payload):
+    """Returns the header fields (or None) and the pixels of a frame. Like
+    the light, the length decides if there is a header (8 bytes on top of
+    whole leds), not what the frame starts with"""
+    if (len(payload) >= STREAM_HEADER.size and
+            len(payload) % 3 == STREAM_HEADER.size % 3):
+        return (STREAM_HEADER.unpack(bytes(payload[:STREAM_HEADER.size])),
+                payload[STREAM_HEADER.size:])
+    return None, payload
+
+
+# ************************************************************************
+# Sending
+# ************************************************************************
+class Stats:
+    def __init__(self, rate=None):
+        self.rate = rate
+        self.reports = []
+        self.sent = 0
+        self.lost = 0
+        self.due = {}  # Frame number -> time it was due to be sent
+        self.delivered = set()
+        self.shown = set()
+        self.latencies = []
+        self.unknown = 0
+
+    def handle_echo(self, packet, now):
+        if packet[:4] == STREAM_REPORT_MAGIC:
+            self.handle_report(packet)
+            return
+        if len(packet) != 4 or packet[:1] not in (b"R", b"S"):
+            self.unknown += 1
+            return
+        number = read_tag(packet[1:])
+        if number not in self.due:
+            self.unknown += 1
+        elif packet[:1] == b"R":
+            self.delivered.add(number)
+        elif number not in self.shown:
+            self.shown.add(number)
+            self.latencies.append((now - self.due[number]) * 1000)
+
+    def handle_report(self, packet):
+        if len(packet) < STREAM_REPORT.size:
+            self.unknown += 1
+            return
+        report = STREAM_REPORT.unpack(bytes(packet[:STREAM_REPORT.size]))
+        if report[1] != STREAM_REPORT_VERSION:
+            self.unknown += 1
+            return
+        self.reports.append(report)
+        if self.rate is not None:
+            self.rate.update(*report[5:9])
+
+    def report(self):
+        frames = len(self.due)
+        echoed = self.delivered or self.shown
+        print("Frames:    %d" % frames)
+        print("Sent:      %d (%d dropped on purpose)" % (self.sent, self.lost))
+        if not echoed:
+            print("No echoes, build with STREAM_ECHO or use the simulator")
+            self.print_reports()
+            return
+        print("Delivered: %d (%.1f%%)" % (len(self.delivered),
+                                          percent(len(self.delivered),
+                                                  self.sent)))
+        print("Shown:     %d (%.1f%% of delivered)" % (
+            len(self.shown), percent(len(self.shown), len(self.delivered))))
+        if self.latencies:
+            latencies = sorted(self.latencies)
+            print("Latency:   p50 %.1f ms, p95 %.1f ms, p99 %.1f ms, max %.1f "
+                  "ms" % (percentile(latencies, 50), percentile(latencies, 95),
+                          percentile(latencies, 99), latencies[-1]))
+        self.print_reports()
+        if self.unknown:
+            print("Ignored %d echoes for frames that weren't sent" %
+                  self.unknown)
+
+
+    def print_reports(self):
+        if not self.reports:
+            return
+        received, shown, dropped, late = [sum(report[i] for report in
+                                              self.reports)
+                                          for i in range(5, 9)]
+        print("Reports:   %d, received %d, shown %d, dropped %d, late %d" %
+              (len(self.reports), received, shown, dropped, late))
+        print("Light:     render %.0f us, show %.0f us on average" %
+              (sum(report[9] for report in self.reports) / len(self.reports),
+               sum(report[10] for report in self.reports) /
+               len(self.reports)))
+
+
+class Rate:
+    """Frame rate of a generated stream, lowered while the light reports
+    missing frames and raised back towards the target after"""
+
+    def __init__(self, fps, adapt):
+        self.target = fps
+        self.fps = fps
+        self.adapt = adapt
+
+    def update(self, received, shown, dropped, late):
+        if not self.adapt or not received:
+            return
+        missing = dropped + late + max(received - shown, 0)
+        if missing > received * ADAPT_THRESHOLD:
+            fps = max(self.fps * 0.8, MIN_FPS)
+        else:
+            fps = min(self.fps * 1.1, self.target)
+        if fps != self.fps:
+            print("%d of %d frames missing, %s to %.1f FPS" %
+                  (missing, received,
+                   "lowering" if fps < self.fps else "raising", fps))
+            self.fps = fps
+
+
+def percent(part, total):
+    return 100.0 * part / total if total else 0.0
+
+
+def percentile(values, p):
+    index = min(len(values) - 1, int(math.ceil(p / 100.0 * len(values))) - 1)
+    return values[max(index, 0)]
+
+
+def send_stream(frames, args, rate=None):
+    """Sends (due time, payload) pairs with the impairments in args"""
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 2)
+    sock.setblocking(False)
+    target = (args.host, args.port)
+    stats = Stats(rate)
+    rng = random.Random(args.seed)
+    queue = []  # (send time, order, frame number, payload)
+    held = None  # Frame being held back to swap with the next one
+
+    start = time.time() + 0.1
+    for number, (due, payload) in enumerate(frames):
+        header, payload = split_header(payload)
+        if args.tag:
+            payload = tag_frame(payload, number, args.tag_every)
+        if args.header or args.interpolate:
+            flags = STREAM_FLAG_INTERPOLATE if args.interpolate else 0
+            payload = STREAM_HEADER.pack(STREAM_MAGIC, flags, 0,
+                                         number & 0xFFFF) + payload
+        elif header is not None:
+            # Keep the header a recording came with
+            payload = STREAM_HEADER.pack(*header) + payload
+        due += start
+        stats.due[number & 0xFFFFFF] = due
+        if rng.random() < args.loss:
+            stats.lost += 1
+            continue
+        send_at = due + rng.uniform(0, args.jitter / 1000.0)
+        if held is not None:
+            # Send the held frame after this one
+            heapq.heappush(queue, (send_at, number, number, payload))
+            heapq.heappush(queue, (send_at, number + 0.5, held[0], held[1]))
+            held = None
+        elif rng.random() < args.reorder:
+            held = (number, payload)
+        else:
+            heapq.heappush(queue, (send_at, number, number, payload))
+        pump(sock, target, queue, stats, due)
+    if held is not None:
+        heapq.heappush(queue, (time.time(), held[0], held[0], held[1]))
+    pump(sock, target, queue, stats, float("inf"))
+    listen(sock, stats, time.time() + ECHO_WAIT)
+    stats.report()
+
+
+def pump(sock, target, queue, stats, until):
+    # Send everything due before until while listening for echoes
+    while queue and queue[0][0] <= until:
+        listen(sock, stats, queue[0][0])
+        _, _, _, payload = heapq.heappop(queue)
+        sock.sendto(payload, target)
+        stats.sent += 1
+    if until != float("inf"):
+        listen(sock, stats, until)
+
+
+def listen(sock, stats, until):
+    while True:
+        timeout = until - time.time()
+        if timeout <= 0:
+            return
+        readable, _, _ = select.select([sock], [], [], timeout)
+        if not readable:
+            return
+        try:
+            packet, _ = sock.recvfrom(MAX_PACKET)
+        except BlockingIOError:
+            continue
+        stats.handle_echo(packet, time.time())
+
+
+# ************************************************************************
+# Commands
+# ************************************************************************
+def generate(args):
+    rate = Rate(args.fps, args.adapt)
+
+    def frames():
+        # Spaced out at whatever the rate is when each frame is made
+        t = 0
+        while t < args.seconds:
+            yield t, rainbow_frame(args.leds, t)
+            t += 1.0 / rate.fps
+
+    print("Sending %g s of %d leds at %g FPS to %s:%d" %
+          (args.seconds, args.leds, args.fps, args.host, args.port))
+    send_stream(frames(), args, rate)
+
+
+def record(args):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("", args.port))
+    if args.group:
+        membership = socket.inet_aton(args.group) + socket.inet_aton("0.0.0.0")
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP,
+                        membership)
+    print("Recording port %d for %g s to %s, stop the light listening on this "
+          "machine first" % (args.port, args.seconds, args.file))
+    count = 0
+    start = None
+    end = time.time() + args.seconds
+    with open(args.file, "wb") as out:
+        out.write(RECORD_MAGIC)
+        while time.time() < end:
+            readable, _, _ = select.select([sock], [], [], end - time.time())
+            if not readable:
+                break
+            packet, _ = sock.recvfrom(MAX_PACKET)
+            now = time.time()
+            if start is None:
+                start = now
+            out.write(RECORD_HEADER.pack(now - start, len(packet)))
+            out.write(packet)
+            count += 1
+    print("Recorded %d frames" % count)
+
+
+def read_recording(path):
+    with open(path, "rb") as f:
+        if f.read(len(RECORD_MAGIC)) != RECORD_MAGIC:
+            sys.exit("[ERROR]: %s isn't a recording" % path)
+        while True:
+            header = f.read(RECORD_HEADER.size)
+            if len(header) < RECORD_HEADER.size:
+                return
+            offset, length = RECORD_HEADER.unpack(header)
+            yield offset, bytearray(f.read(length))
+
+
+def replay(args):
+    print("Replaying %s to %s:%d" % (args.file, args.host, args.port))
+    send_stream(read_recording(args.file), args)
+
+
+def simulate(args):
+    """Accepts frames like Light::handleVisualize and shows them at the
+    controller's frame rate, spending show-time us on each show"""
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("", args.port))
+    if args.group:
+        membership = socket.inet_aton(args.group) + socket.inet_aton("0.0.0.0")
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP,
+                        membership)
+    slice_start = args.slice_offset * 3
+    # Frames are exactly the canvas, with or without the header, like
+    # Light.cpp
+    frame_size = max(args.canvas, args.slice_offset + args.leds) * 3
+    sequence = None
+    last_frame = 0  # When the last frame was accepted
+    print("Simulating %d leds on port %d, showing at %d FPS in %d us" %
+          (args.leds, args.port, FRAMES_PER_SECOND, args.show_time))
+
+    frame_time = 1.0 / FRAMES_PER_SECOND
+    next_show = time.time()
+    pending = None  # (sender, tag) of the frame waiting to be shown
+    source = None  # Where the last packet came from, gets the reports
+    received = shown = invalid = late = shows = 0
+    second = time.time()
+    while True:
+        readable, _, _ = select.select([sock], [], [],
+                                       max(next_show - time.time(), 0))
+        if readable:
+            packet, sender = sock.recvfrom(MAX_PACKET)
+            source = sender
+            if len(packet) not in (frame_size,
+                                   frame_size + STREAM_HEADER.size):
+                invalid += 1
+                continue
+            header, packet = split_header(packet)
+            if header is not None and header[0] != STREAM_MAGIC:
+                invalid += 1
+                continue
+            if header is not None:
+                # Repeats and frames older than the last one are dropped as
+                # late, like Light.cpp, unless the stream stopped for a while
+                difference = (header[3] - (sequence or 0)) & 0xFFFF
+                new_stream = (sequence is None or
+                              time.time() - last_frame > STREAM_TIMEOUT)
+                if not new_stream and (difference == 0 or
+                                       difference & 0x8000):
+                    late += 1
+                    continue
+                sequence = header[3]
+            tag = packet[slice_start:slice_start + 3]
+            sock.sendto(b"R" + tag, sender)
+            pending = (sender, tag)
+            last_frame = time.time()
+            received += 1
+            continue
+        now = time.time()
+        if now < next_show:
+            continue
+        # The strip is busy for show-time after every show
+        busy_until = now + args.show_time / 1e6
+        while time.time() < busy_until:
+            pass
+        if pending is not None:
+            sock.sendto(b"S" + pending[1], pending[0])
+            pending = None
+            shown += 1
+        shows += 1
+        next_show = max(next_show + frame_time, time.time())
+        if now - second >= 1:
+            print("received %d, shown %d, invalid %d, late %d" %
+                  (received, shown, invalid, late))
+            if source is not None:
+                sock.sendto(STREAM_REPORT.pack(
+                    STREAM_REPORT_MAGIC, STREAM_REPORT_VERSION, 0,
+                    sequence or 0, int((now - second) * 1000), received,
+                    shown, invalid, late, 0,
+                    args.show_time if shows else 0), source)
+                source = None
+            received = shown = invalid = late = shows = 0
+            second = now
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    commands = parser.add_subparsers(dest="command")
+    commands.required = True
+
+    def add_sender_args(command):
+        command.add_argument("host", help="light or multicast group address")
+        command.add_argument("--port", type=int, default=STREAM_PORT)
+        command.add_argument("--loss", type=float, default=0,
+                             help="chance of dropping each frame (0-1)")
+        command.add_argument("--reorder", type=float, default=0,
+                             help="chance of sending a frame after the next")
+        command.add_argument("--jitter", type=float, default=0,
+                             help="random delay of up to this many ms")
+        command.add_argument("--tag-every", type=int, default=1 << 24,
+                             help="put the frame number in every Nth pixel "
+                             "(the slice length when streaming to a group)")
+        command.add_argument("--no-tag", dest="tag", action="store_false",
+                             help="send frames untouched (no echo stats)")
+        command.add_argument("--header", action="store_true",
+                             help="start frames with the stream header")
+        command.add_argument("--interpolate", action="store_true",
+                             help="send the header and let the light blend "
+                             "between frames")
+        command.add_argument("--seed", type=int, default=None,
+                             help="random seed to repeat impairments")
+
+    command = commands.add_parser("generate", help="send a test pattern")
+    add_sender_args(command)
+    command.add_argument("--leds", type=int, default=150)
+    command.add_argument("--fps", type=float, default=FRAMES_PER_SECOND)
+    command.add_argument("--seconds", type=float, default=10)
+    command.add_argument("--adapt", action="store_true",
+                         help="lower the frame rate while the light reports "
+                         "missing frames")
+    command.set_defaults(handler=generate)
+
+    command = commands.add_parser("record", help="record a stream to a file")
+    command.add_argument("file")
+    command.add_argument("--port", type=int, default=STREAM_PORT)
+    command.add_argument("--group", help="multicast group to join")
+    command.add_argument("--seconds", type=float, default=30)
+    command.set_defaults(handler=record)
+
+    command = commands.add_parser("replay", help="replay a recorded stream")
+    command.add_argument("file")
+    add_sender_args(command)
+    command.set_defaults(handler=replay)
+
+    command = commands.add_parser("simulate",
+                                  help="act like a light showing a stream")
+    command.add_argument("--port", type=int, default=STREAM_PORT)
+    command.add_argument("--group", help="multicast group to join")
+    command.add_argument("--leds", type=int, default=150,
+                         help="slice length in leds")
+    command.add_argument("--slice-offset", type=int, default=0)
+    command.add_argument("--canvas", type=int, default=0,
+                         help="leds in every frame (default: up to the end "
+                         "of the slice)")
+    command.add_argument("--show-time", type=int, default=4500,
+                         help="us to send a frame (30 us per WS2812B led)")
+    command.set_defaults(handler=simulate)
+
+    args = parser.parse_args()
+    args.handler(args)
+
+
+if __name__ == "__main__":
+    main()